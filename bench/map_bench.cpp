@@ -0,0 +1,360 @@
+#include <benchmark/benchmark.h>
+#include "lockfree/lockfree.h"
+#include "lockfree/numa.h"
+#include "lockfree/sharded.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Benchmarks for LockFreeMap, against std::unordered_map behind a mutex.
+// Run with --benchmark_format=json (or the bench_json target) to keep the results.
+//
+// Common arguments: number of keys the map is populated with, percentage of reads
+// among the operations, percentage of operations that hit a populated key.
+
+namespace {
+
+struct LockFreeAdapter {
+  explicit LockFreeAdapter(int keys): m_map(std::max(16, keys * 2)) {}
+
+  int get(int k) { return m_map.get(k); }
+  void insert(int k, int v) { m_map.insert(k, v); }
+
+  LockFreeMap<int, int> m_map;
+};
+
+// tables in anonymous mappings, cleared by the kernel as they are touched
+struct MappedAdapter {
+  using MappedTable = Table<int, int, key_traits<int>, value_traits<int>, modulo_indexing, packed_layout, mmap_allocation>;
+
+  explicit MappedAdapter(int keys): m_map(std::max(16, keys * 2)) {}
+
+  int get(int k) { return m_map.get(k); }
+  void insert(int k, int v) { m_map.insert(k, v); }
+
+  LockFreeMap<int, int, key_traits<int>, value_traits<int>, epoch_reclamation, MappedTable> m_map;
+};
+
+// two bucket reads at most per lookup, in line aligned mapped memory
+struct TwoChoiceAdapter {
+  using TwoChoiceTable = Table<int, int, key_traits<int>, value_traits<int>, pow2_indexing, packed_layout, mmap_allocation, two_choice_probing<8>>;
+
+  explicit TwoChoiceAdapter(int keys): m_map(std::max(16, keys * 2), 0.7) {}
+
+  int get(int k) { return m_map.get(k); }
+  void insert(int k, int v) { m_map.insert(k, v); }
+
+  LockFreeMap<int, int, key_traits<int>, value_traits<int>, epoch_reclamation, TwoChoiceTable> m_map;
+};
+
+// a replica of the map per NUMA node, reads stay on the reader's node
+struct ReplicatedAdapter {
+  explicit ReplicatedAdapter(int keys): m_map(std::max(16, keys * 2)) {}
+
+  int get(int k) { return m_map.get(k); }
+  void insert(int k, int v) { m_map.insert(k, v); }
+
+  ReplicatedLockFreeMap<int, int> m_map;
+};
+
+// one map with its tables interleaved over the nodes
+struct InterleavedAdapter {
+  using InterleavedTable = Table<int, int, key_traits<int>, value_traits<int>, modulo_indexing, packed_layout, numa_allocation>;
+
+  explicit InterleavedAdapter(int keys): m_map(std::max(16, keys * 2)) {}
+
+  int get(int k) { return m_map.get(k); }
+  void insert(int k, int v) { m_map.insert(k, v); }
+
+  LockFreeMap<int, int, key_traits<int>, value_traits<int>, epoch_reclamation, InterleavedTable> m_map;
+};
+
+struct ShardedAdapter {
+  explicit ShardedAdapter(int keys): m_map(std::max(16, keys * 2)) {}
+
+  int get(int k) { return m_map.get(k); }
+  void insert(int k, int v) { m_map.insert(k, v); }
+
+  ShardedLockFreeMap<int, int> m_map;
+};
+
+struct MutexAdapter {
+  explicit MutexAdapter(int keys) { m_map.reserve(keys); }
+
+  int get(int k) {
+    std::lock_guard<std::mutex> lg(m_mutex);
+    auto it = m_map.find(k);
+    return it == m_map.end() ? 0 : it->second;
+  }
+
+  void insert(int k, int v) {
+    std::lock_guard<std::mutex> lg(m_mutex);
+    m_map[k] = v;
+  }
+
+  std::mutex m_mutex;
+  std::unordered_map<int, int> m_map;
+};
+
+// key distributions, each draws ranks in [0, n)
+
+struct Uniform {
+  Uniform(int n, int thread): m_rng(1234 + thread), m_dist(0, n - 1) {}
+  int next() { return m_dist(m_rng); }
+
+  std::mt19937 m_rng;
+  std::uniform_int_distribution<int> m_dist;
+};
+
+struct Sequential {
+  Sequential(int n, int thread): m_n(n), m_next((static_cast<long long>(n) * thread / 7) % n) {}
+  int next() {
+    auto r = m_next;
+    if (++m_next == m_n) m_next = 0;
+    return r;
+  }
+
+  int m_n;
+  int m_next;
+};
+
+// YCSB's scrambled zipfian, theta 0.99, hot ranks spread over the key space
+struct Zipfian {
+  static double zeta(int n, double theta) {
+    static std::mutex mutex;
+    static std::map<int, double> cache;
+
+    std::lock_guard<std::mutex> lg(mutex);
+    auto it = cache.find(n);
+    if (it != cache.end()) return it->second;
+
+    double sum = 0;
+    for (int i = 1; i <= n; ++i) sum += 1.0 / std::pow(i, theta);
+    return cache[n] = sum;
+  }
+
+  Zipfian(int n, int thread): m_n(n), m_rng(4321 + thread), m_uniform(0.0, 1.0) {
+    const double theta = 0.99;
+    m_zetan = zeta(n, theta);
+    m_alpha = 1.0 / (1.0 - theta);
+    m_eta = (1.0 - std::pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / m_zetan);
+    m_secondThreshold = 1.0 + std::pow(0.5, theta);
+  }
+
+  int next() {
+    auto u = m_uniform(m_rng);
+    auto uz = u * m_zetan;
+    long long rank;
+    if (uz < 1.0) rank = 0;
+    else if (uz < m_secondThreshold) rank = 1;
+    else rank = std::min<long long>(m_n - 1, static_cast<long long>(m_n * std::pow(m_eta * u - m_eta + 1.0, m_alpha)));
+
+    return static_cast<int>((rank * 2654435761ll) % m_n);
+  }
+
+  int m_n;
+  std::mt19937 m_rng;
+  std::uniform_real_distribution<double> m_uniform;
+  double m_zetan, m_alpha, m_eta, m_secondThreshold;
+};
+
+struct Operation {
+  int key;
+  bool read;
+};
+
+// operations are drawn up front so the timed loop only touches the map
+template <typename Distribution>
+std::vector<Operation> makeOperations(int keys, int readPercent, int hitPercent, int thread) {
+  const int count = 1 << 16;
+  Distribution dist(keys, thread);
+  std::mt19937 rng(99 + thread);
+  std::uniform_int_distribution<int> percent(0, 99);
+
+  std::vector<Operation> ops(count);
+  for (auto& op : ops) {
+    auto hit = percent(rng) < hitPercent;
+    // populated keys are 1..keys, misses land right above them
+    op.key = dist.next() + 1 + (hit ? 0 : keys);
+    op.read = percent(rng) < readPercent;
+  }
+  return ops;
+}
+
+template <typename Adapter>
+std::unique_ptr<Adapter>& sharedMap() {
+  static std::unique_ptr<Adapter> map;
+  return map;
+}
+
+template <typename Adapter>
+void populate(const benchmark::State& state) {
+  auto keys = static_cast<int>(state.range(0));
+  sharedMap<Adapter>().reset(new Adapter(keys));
+  for (int k = 1; k <= keys; ++k) {
+    sharedMap<Adapter>()->insert(k, k);
+  }
+}
+
+template <typename Adapter>
+void release(const benchmark::State&) {
+  sharedMap<Adapter>().reset();
+}
+
+template <typename Adapter, typename Distribution>
+void BM_Operations(benchmark::State& state) {
+  auto keys = static_cast<int>(state.range(0));
+  auto ops = makeOperations<Distribution>(keys, static_cast<int>(state.range(1)), static_cast<int>(state.range(2)), state.thread_index());
+  auto& map = *sharedMap<Adapter>();
+
+  size_t i = 0;
+  for (auto _ : state) {
+    auto& op = ops[i++ & (ops.size() - 1)];
+    if (op.read) {
+      benchmark::DoNotOptimize(map.get(op.key));
+    } else {
+      map.insert(op.key, op.key);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+// BM_Operations that also counts the operations of each NUMA node, the node a
+// thread ran on at the end stands for the whole run
+template <typename Adapter>
+void BM_PerNodeOperations(benchmark::State& state) {
+  BM_Operations<Adapter, Uniform>(state);
+  auto node = "node" + std::to_string(numa_topology::currentNode()) + "_items";
+  state.counters[node] = benchmark::Counter(static_cast<double>(state.iterations()), benchmark::Counter::kIsRate);
+}
+
+// distinct keys from every thread into a map that starts tiny and keeps growing
+template <typename Adapter>
+void BM_SustainedGrowth(benchmark::State& state) {
+  auto& map = *sharedMap<Adapter>();
+  int k = 1 + state.thread_index() * (1 << 24);
+
+  for (auto _ : state) {
+    map.insert(k, k);
+    ++k;
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+// lookups in batches of range(1) keys, getMany against one get per key
+template <bool Batched>
+void BM_LockFreeBatchedGets(benchmark::State& state) {
+  auto keys = static_cast<int>(state.range(0));
+  auto batch = static_cast<size_t>(state.range(1));
+  auto ops = makeOperations<Uniform>(keys, 100, 100, state.thread_index());
+  auto& map = sharedMap<LockFreeAdapter>()->m_map;
+
+  std::vector<int> batchKeys(ops.size());
+  for (size_t i = 0; i < ops.size(); ++i) batchKeys[i] = ops[i].key;
+  std::vector<int> values(batch);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    auto begin = &batchKeys[i];
+    if (Batched) {
+      map.getMany(begin, values.data(), batch);
+    } else {
+      for (size_t j = 0; j < batch; ++j) values[j] = map.get(begin[j]);
+    }
+    benchmark::DoNotOptimize(values.data());
+
+    i += batch;
+    if (i + batch > batchKeys.size()) i = 0;
+  }
+
+  state.SetItemsProcessed(state.iterations() * batch);
+}
+
+template <typename Adapter>
+void startSmall(const benchmark::State&) {
+  sharedMap<Adapter>().reset(new Adapter(8));
+}
+
+int maxThreads() {
+  return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+// table sizes from L1 resident to well past the LLC
+const std::vector<int64_t> KeyCounts = { 1 << 10, 1 << 14, 1 << 18, 1 << 22 };
+
+} // namespace
+
+// read/write mixes over every table size
+#define LOCKFREE_MIX_BENCHMARK(Adapter)                                              \
+  BENCHMARK_TEMPLATE(BM_Operations, Adapter, Uniform)                                \
+    ->ArgNames({ "keys", "read%", "hit%" })                                          \
+    ->ArgsProduct({ KeyCounts, { 50, 90, 100 }, { 100 } })                          \
+    ->ThreadRange(1, maxThreads())                                                   \
+    ->Setup(populate<Adapter>)->Teardown(release<Adapter>)->UseRealTime()
+
+LOCKFREE_MIX_BENCHMARK(LockFreeAdapter);
+LOCKFREE_MIX_BENCHMARK(ShardedAdapter);
+LOCKFREE_MIX_BENCHMARK(MutexAdapter);
+
+// key distributions and hit ratios, at a size that lives in the LLC
+#define LOCKFREE_DISTRIBUTION_BENCHMARK(Adapter, Distribution)                       \
+  BENCHMARK_TEMPLATE(BM_Operations, Adapter, Distribution)                           \
+    ->ArgNames({ "keys", "read%", "hit%" })                                          \
+    ->ArgsProduct({ { 1 << 18 }, { 90 }, { 0, 50, 100 } })                          \
+    ->ThreadRange(1, maxThreads())                                                   \
+    ->Setup(populate<Adapter>)->Teardown(release<Adapter>)->UseRealTime()
+
+LOCKFREE_DISTRIBUTION_BENCHMARK(LockFreeAdapter, Uniform);
+LOCKFREE_DISTRIBUTION_BENCHMARK(LockFreeAdapter, Zipfian);
+LOCKFREE_DISTRIBUTION_BENCHMARK(LockFreeAdapter, Sequential);
+LOCKFREE_DISTRIBUTION_BENCHMARK(TwoChoiceAdapter, Uniform);
+LOCKFREE_DISTRIBUTION_BENCHMARK(TwoChoiceAdapter, Zipfian);
+LOCKFREE_DISTRIBUTION_BENCHMARK(MutexAdapter, Uniform);
+LOCKFREE_DISTRIBUTION_BENCHMARK(MutexAdapter, Zipfian);
+LOCKFREE_DISTRIBUTION_BENCHMARK(MutexAdapter, Sequential);
+
+// read-mostly maps past the LLC, where a remote node costs on every probe
+#define LOCKFREE_NUMA_BENCHMARK(Adapter)                                             \
+  BENCHMARK_TEMPLATE(BM_PerNodeOperations, Adapter)                                  \
+    ->ArgNames({ "keys", "read%", "hit%" })                                          \
+    ->ArgsProduct({ { 1 << 22 }, { 95 }, { 100 } })                                 \
+    ->ThreadRange(1, maxThreads())                                                   \
+    ->Setup(populate<Adapter>)->Teardown(release<Adapter>)->UseRealTime()
+
+LOCKFREE_NUMA_BENCHMARK(LockFreeAdapter);
+LOCKFREE_NUMA_BENCHMARK(InterleavedAdapter);
+LOCKFREE_NUMA_BENCHMARK(ReplicatedAdapter);
+
+BENCHMARK_TEMPLATE(BM_LockFreeBatchedGets, true)
+  ->ArgNames({ "keys", "batch" })->ArgsProduct({ KeyCounts, { 16, 128 } })
+  ->ThreadRange(1, maxThreads())
+  ->Setup(populate<LockFreeAdapter>)->Teardown(release<LockFreeAdapter>)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_LockFreeBatchedGets, false)
+  ->ArgNames({ "keys", "batch" })->ArgsProduct({ KeyCounts, { 16, 128 } })
+  ->ThreadRange(1, maxThreads())
+  ->Setup(populate<LockFreeAdapter>)->Teardown(release<LockFreeAdapter>)->UseRealTime();
+
+BENCHMARK_TEMPLATE(BM_SustainedGrowth, LockFreeAdapter)
+  ->Iterations(1 << 20)->ThreadRange(1, maxThreads())
+  ->Setup(startSmall<LockFreeAdapter>)->Teardown(release<LockFreeAdapter>)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SustainedGrowth, MappedAdapter)
+  ->Iterations(1 << 20)->ThreadRange(1, maxThreads())
+  ->Setup(startSmall<MappedAdapter>)->Teardown(release<MappedAdapter>)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SustainedGrowth, ShardedAdapter)
+  ->Iterations(1 << 20)->ThreadRange(1, maxThreads())
+  ->Setup(startSmall<ShardedAdapter>)->Teardown(release<ShardedAdapter>)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_SustainedGrowth, MutexAdapter)
+  ->Iterations(1 << 20)->ThreadRange(1, maxThreads())
+  ->Setup(startSmall<MutexAdapter>)->Teardown(release<MutexAdapter>)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,112 @@
+#include "lockfree/table.h"
+#include "lockfree/tagged_table.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+// Negative lookups: with early terminating probes the cost per miss should stay
+// flat as the table grows, instead of growing with its size, and the probes per
+// miss should only rise with the load factor. This file builds two programs:
+// lockfree_miss_bench times the misses without statistics, lockfree_miss_probes is
+// built with LOCKFREE_ENABLE_STATS and reads the probe count every lookup leaves
+// behind, a thread local store that would otherwise be part of the timing. Tagged
+// tables count the groups they probed.
+struct MissResult {
+  double nanos;
+  double meanProbes;
+  int maxProbes;
+};
+
+template <typename TableType>
+MissResult measureMisses(int size, double loadFactor, int lookups) {
+  TableType t(size, size);
+  int keys = static_cast<int>(t.m_size * loadFactor);
+  for (int k = 1; k <= keys; ++k) {
+    t.fillFirstCellFor(k)->value.store(k);
+  }
+
+  MissResult result{ 0, 0, 0 };
+#ifdef LOCKFREE_ENABLE_STATS
+  long long probes = 0;
+  for (int i = 0; i < lookups; ++i) {
+    t.findFirstCellFor(keys + 1 + i);
+    auto p = probe_stats::scratch().lastProbe;
+    probes += p;
+    result.maxProbes = std::max(result.maxProbes, p);
+  }
+  result.meanProbes = static_cast<double>(probes) / lookups;
+#else
+  int found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < lookups; ++i) {
+    if (t.findFirstCellFor(keys + 1 + i) != nullptr) ++found;
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+  if (found) printf("unexpected hits\n");
+  result.nanos = static_cast<double>(elapsed.count()) / lookups;
+#endif
+  return result;
+}
+
+using ModuloTable = Table<int, int>;
+using Pow2Table = Table<int, int, key_traits<int>, value_traits<int>, pow2_indexing>;
+using SplitTable = Table<int, int, key_traits<int>, value_traits<int>, pow2_indexing, split_layout>;
+using Pow2TaggedTable = TaggedTable<int, int, key_traits<int>, value_traits<int>, pow2_indexing>;
+
+// ns per miss, or mean and max probes, of each table
+void printRow(const char* label, int size, double loadFactor, int lookups) {
+  MissResult results[] = {
+    measureMisses<ModuloTable>(size, loadFactor, lookups),
+    measureMisses<Pow2Table>(size, loadFactor, lookups),
+    measureMisses<SplitTable>(size, loadFactor, lookups),
+    measureMisses<Pow2TaggedTable>(size, loadFactor, lookups),
+  };
+
+  printf("%12s", label);
+  for (auto& r : results) {
+#ifdef LOCKFREE_ENABLE_STATS
+    printf(" %6.2f %5d", r.meanProbes, r.maxProbes);
+#else
+    printf(" %12.2f", r.nanos);
+#endif
+  }
+  printf("\n");
+}
+
+void printHeader(const char* label) {
+  printf("%12s", label);
+  for (auto name : { "modulo", "pow2", "pow2+split", "pow2+tags" }) {
+    printf(" %12s", name);
+  }
+  printf("\n%12s", "");
+  for (int i = 0; i < 4; ++i) {
+#ifdef LOCKFREE_ENABLE_STATS
+    printf(" %6s %5s", "mean", "max");
+#else
+    printf(" %12s", "ns/miss");
+#endif
+  }
+  printf("\n");
+}
+
+int main() {
+  const int lookups = 1 << 20;
+  char label[32];
+
+  printf("misses as the table grows, load factor 0.5\n");
+  printHeader("cells");
+  for (int size = 1 << 10; size <= 1 << 24; size <<= 2) {
+    snprintf(label, sizeof(label), "%d", size);
+    printRow(label, size, 0.5, lookups);
+  }
+
+  const int size = 1 << 20;
+  printf("\nmisses as the load factor rises, %d cells\n", size);
+  printHeader("load factor");
+  for (int percent = 10; percent <= 90; percent += 10) {
+    snprintf(label, sizeof(label), "%.1f", percent / 100.0);
+    printRow(label, size, percent / 100.0, lookups);
+  }
+
+  return 0;
+}
@@ -0,0 +1,126 @@
+#ifndef ALLOCATION_H
+#define ALLOCATION_H
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Allocation policies hand out the memory of a table's cells.
+//   allocate(bytes)       - memory for the cells, aligned to at least 16 bytes
+//   release(p, bytes)     - gives it back, bytes as they were allocated
+//   ZeroFilled            - fresh memory reads as all zero bits, so a storage whose
+//                           empty cells are all zero bits can skip clearing them
+
+// the global operator new, cells are cleared by the storage
+struct heap_allocation {
+  enum { ZeroFilled = 0 };
+
+  static void* allocate(size_t bytes) { return ::operator new(bytes); }
+  static void release(void* p, size_t) { ::operator delete(p); }
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// Anonymous mappings. The kernel hands out zero pages and only backs a page once it
+// is first written, so a new table costs next to nothing until it fills up and
+// growing never stops the world to clear gigabytes. Big tables ask for huge pages,
+// explicit ones (MAP_HUGETLB) when the system reserved some, transparent ones
+// (MADV_HUGEPAGE) otherwise, to take pressure off the TLB while probing.
+struct mmap_allocation {
+  enum { ZeroFilled = 1 };
+
+  enum { HugePageSize = 2 * 1024 * 1024 };
+
+  static void* allocate(size_t bytes) {
+    auto length = mappedLength(bytes);
+    void* p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (length >= static_cast<size_t>(HugePageSize)) {
+      p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+#endif
+    if (p == MAP_FAILED) {
+      p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) throw std::bad_alloc();
+
+#ifdef MADV_HUGEPAGE
+      if (length >= static_cast<size_t>(HugePageSize)) madvise(p, length, MADV_HUGEPAGE);
+#endif
+    }
+    return p;
+  }
+
+  static void release(void* p, size_t bytes) {
+    munmap(p, mappedLength(bytes));
+  }
+
+private:
+  // huge page sized mappings for anything that could use a huge page
+  static size_t mappedLength(size_t bytes) {
+    auto granule = bytes >= static_cast<size_t>(HugePageSize) ? static_cast<size_t>(HugePageSize) : static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return (bytes + granule - 1) / granule * granule;
+  }
+};
+
+#endif
+
+// true if v is all zero bits, as fresh memory of a ZeroFilled allocation is
+template <typename T>
+bool isZeroBits(const T& v) {
+  static const unsigned char zeros[sizeof(T)] = {};
+  return std::memcmp(&v, zeros, sizeof(T)) == 0;
+}
+
+// Cells a table finds in memory it did not allocate, e.g. a file mapped by
+// persistence.h. The memory reads as all zero bits, unless it already holds the
+// cells of a table of the same type (holdsCells). release(memory, bytes) gives it
+// back along with the table, without one that is left to whoever placed the cells.
+struct PlacedCells {
+  void* cells;
+  bool holdsCells;
+  void* memory;
+  size_t bytes;
+  void (*release)(void* memory, size_t bytes);
+};
+
+// The memory of a storage, from its allocation policy or placed by the caller.
+template <typename AllocationType>
+class CellMemory {
+public:
+  CellMemory(size_t bytes, const PlacedCells* placed):
+    m_bytes(bytes), m_isPlaced(placed != nullptr), m_placed(placed != nullptr ? *placed : PlacedCells()),
+    m_cells(placed != nullptr ? placed->cells : AllocationType::allocate(bytes)) {}
+
+  ~CellMemory() {
+    if (!m_isPlaced) AllocationType::release(m_cells, m_bytes);
+    else if (m_placed.release != nullptr) m_placed.release(m_placed.memory, m_placed.bytes);
+  }
+
+  CellMemory(const CellMemory&) = delete;
+  CellMemory& operator=(const CellMemory&) = delete;
+
+  char* get() const { return static_cast<char*>(m_cells); }
+
+  // whether the storage can leave its cells as they are: they read as empty cells
+  // already, or were placed holding the cells of a table
+  template <typename KeyType, typename ValueType>
+  bool skipsClearing(const KeyType& emptyKey, const ValueType& emptyValue) const {
+    if (m_placed.holdsCells) return true;
+    auto zeroFilled = m_isPlaced || AllocationType::ZeroFilled;
+    return zeroFilled && isZeroBits(emptyKey) && isZeroBits(emptyValue);
+  }
+
+private:
+  size_t m_bytes;
+  bool m_isPlaced;
+  PlacedCells m_placed;
+  void* m_cells;
+};
+
+#endif // ALLOCATION_H
@@ -0,0 +1,274 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+
+#include "allocation.h"
+#include "stats.h"
+#include "table.h"
+
+// What a cache went through so far, summed without a common point in time like
+// MapStatsSnapshot.
+struct CacheStatsSnapshot {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t insertions;   // keys that were not in the cache
+  uint64_t evictions;    // keys that made room for others
+};
+
+// Fixed capacity cache of keys and values that pack into a word together, see
+// PackedWord. Keys hash to a set of 7 cells that shares a cache line with the
+// set's CLOCK state: a reference bit per cell, set by hits, and the clock hand.
+// A key only ever lives in its own set, so there are no probe chains to keep
+// intact and an evicted cell takes the new key and value in the same CAS.
+// Memory stays what the constructor allocated, whatever the key space does.
+//
+// Two threads that bring in the same key at once may both get a cell for it.
+// The copy in the lower cell wins, lookups find that one first. Each thread looks
+// at the whole set after placing its copy, and at least one of them sees both:
+// the copy in the higher cell is taken back out, and a thread whose own copy
+// that was writes to the winner instead. So at most one copy stays.
+template <typename Tkey, typename Tvalue, typename Tkey_traits = key_traits<Tkey>, typename Tvalue_traits = value_traits<Tvalue>,
+          typename Tallocation = heap_allocation>
+class LockFreeCache {
+public:
+  using KeyType = Tkey;
+  using ValueType = Tvalue;
+  using KeyTraitsType = Tkey_traits;
+  using ValueTraitsType = Tvalue_traits;
+  using AllocationType = Tallocation;
+
+  enum { Ways = 7 };
+
+private:
+  using Word = PackedWord<KeyType, ValueType>;
+
+  static_assert(std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValueType>::value,
+                "cache cells pack keys and values into a word");
+
+  // one cache line: the CLOCK state, the reference bits in the low byte and the
+  // hand above them, and the cells
+  struct Set {
+    std::atomic<uint64_t> clock;
+    std::atomic<uint64_t> cells[Ways];
+  };
+
+  enum { HandShift = 8 };
+
+  enum Counter {
+    Hits, Misses, Insertions, Evictions, Counters
+  };
+
+public:
+  // room for at least capacity keys
+  explicit LockFreeCache(int capacity):
+    m_setCount(checkedSetCount(capacity)),
+    m_empty(Word::pack(KeyTraitsType::defaultValue(), ValueTraitsType::defaultValue())),
+    m_memory(AllocationType::allocate(bytes())) {
+    // the allocation policy only promises 16 bytes of alignment, the sets start at
+    // the first cache line boundary of the memory, bytes() leaves room for that
+    auto address = reinterpret_cast<uintptr_t>(m_memory);
+    m_sets = reinterpret_cast<Set*>((address + CacheLineSize - 1) & ~static_cast<uintptr_t>(CacheLineSize - 1));
+
+    auto zeroed = AllocationType::ZeroFilled && m_empty == 0;
+    for (int s = 0; s < m_setCount && !zeroed; ++s) {
+      new (&m_sets[s].clock) std::atomic<uint64_t>(0);
+      for (auto& cell : m_sets[s].cells) {
+        new (&cell) std::atomic<uint64_t>(m_empty);
+      }
+    }
+  }
+
+  ~LockFreeCache() {
+    AllocationType::release(m_memory, bytes());
+  }
+
+  LockFreeCache(const LockFreeCache&) = delete;
+  LockFreeCache& operator=(const LockFreeCache&) = delete;
+
+  int capacity() const {
+    return m_setCount * Ways;
+  }
+
+  // the value of k, or the default value if it isn't cached
+  ValueType get(KeyType k) {
+    auto& set = setFor(k);
+    for (int i = 0; i < Ways; ++i) {
+      auto word = set.cells[i].load(std::memory_order::memory_order_acquire);
+      if (holds(word, k)) {
+        reference(set, i);
+        m_counters.add(Hits);
+        return Word::value(word);
+      }
+    }
+
+    m_counters.add(Misses);
+    return ValueTraitsType::defaultValue();
+  }
+
+  // Caches v for k, evicting a key of the same set if it is full. Inserting the
+  // default value removes k. Returns v.
+  ValueType insert(KeyType k, ValueType v) {
+    if (v == ValueTraitsType::defaultValue()) {
+      remove(k);
+      return v;
+    }
+
+    auto& set = setFor(k);
+    auto entry = Word::pack(k, v);
+    for (;;) {
+      auto freeCell = -1;
+      auto present = false;
+
+      for (int i = 0; i < Ways && !present; ++i) {
+        auto word = set.cells[i].load(std::memory_order::memory_order_acquire);
+        if (holds(word, k)) {
+          present = true;
+          // the value is only replaced while the cell still holds k
+          while (holds(word, k)) {
+            if (set.cells[i].compare_exchange_weak(word, entry)) return v;
+          }
+        } else if (word == m_empty && freeCell < 0) {
+          freeCell = i;
+        }
+      }
+      // k was evicted while it was being updated
+      if (present) continue;
+
+      auto cell = freeCell;
+      auto expected = m_empty;
+      if (cell < 0) {
+        cell = victim(set);
+        expected = set.cells[cell].load(std::memory_order::memory_order_acquire);
+        if (holds(expected, k)) continue;
+      }
+
+      if (!set.cells[cell].compare_exchange_strong(expected, entry)) continue;
+
+      if (expected != m_empty) m_counters.add(Evictions);
+      if (keepsCopy(set, k, cell)) {
+        m_counters.add(Insertions);
+        return v;
+      }
+    }
+  }
+
+  // returns the value k had, the default value if it wasn't cached
+  ValueType remove(KeyType k) {
+    auto& set = setFor(k);
+    auto removed = ValueTraitsType::defaultValue();
+
+    // every copy, should two threads have brought k in at once
+    for (int i = 0; i < Ways; ++i) {
+      auto word = set.cells[i].load(std::memory_order::memory_order_acquire);
+      while (holds(word, k)) {
+        if (set.cells[i].compare_exchange_weak(word, m_empty)) {
+          if (removed == ValueTraitsType::defaultValue()) removed = Word::value(word);
+          break;
+        }
+      }
+    }
+    return removed;
+  }
+
+  // keys cached right now, counted cell by cell
+  int size() {
+    auto n = 0;
+    for (int s = 0; s < m_setCount; ++s) {
+      for (auto& cell : m_sets[s].cells) {
+        if (cell.load(std::memory_order::memory_order_relaxed) != m_empty) ++n;
+      }
+    }
+    return n;
+  }
+
+  CacheStatsSnapshot stats() const {
+    CacheStatsSnapshot result = CacheStatsSnapshot();
+    result.hits = m_counters.sum(Hits);
+    result.misses = m_counters.sum(Misses);
+    result.insertions = m_counters.sum(Insertions);
+    result.evictions = m_counters.sum(Evictions);
+    return result;
+  }
+
+private:
+  static int checkedSetCount(int capacity) {
+    if (capacity <= 0) throw std::invalid_argument("capacity must be positive");
+    return (capacity + Ways - 1) / Ways;
+  }
+
+  size_t bytes() const {
+    return m_setCount * sizeof(Set) + CacheLineSize;
+  }
+
+  Set& setFor(KeyType k) {
+    return m_sets[KeyTraitsType::hash(k) % static_cast<uint32_t>(m_setCount)];
+  }
+
+  bool holds(uint64_t word, KeyType k) const {
+    return word != m_empty && key_equality<KeyTraitsType>::equal(Word::key(word), k);
+  }
+
+  // only written when the bit isn't set yet, hot keys keep their line shared
+  static void reference(Set& set, int cell) {
+    auto bit = static_cast<uint64_t>(1) << cell;
+    if ((set.clock.load(std::memory_order::memory_order_relaxed) & bit) == 0) {
+      set.clock.fetch_or(bit, std::memory_order::memory_order_relaxed);
+    }
+  }
+
+  // Sweeps the hand over the set: a referenced cell loses its bit and gets a second
+  // chance, the first one that isn't referenced is the victim. After a whole round
+  // every bit is clear, so a sweep stops within Ways + 1 cells.
+  static int victim(Set& set) {
+    auto clock = set.clock.load(std::memory_order::memory_order_relaxed);
+    for (;;) {
+      auto references = clock & ((static_cast<uint64_t>(1) << HandShift) - 1);
+      auto cell = static_cast<int>(clock >> HandShift);
+      while (references & (static_cast<uint64_t>(1) << cell)) {
+        references &= ~(static_cast<uint64_t>(1) << cell);
+        cell = (cell + 1) % Ways;
+      }
+
+      auto next = references | (static_cast<uint64_t>((cell + 1) % Ways) << HandShift);
+      if (set.clock.compare_exchange_weak(clock, next, std::memory_order::memory_order_relaxed)) {
+        return cell;
+      }
+    }
+  }
+
+  // After k went into cell: false if a lower cell holds k as well. Then the copy
+  // is taken back out, with whatever got written to it meanwhile, and the caller
+  // writes to the lower cell instead. Copies in higher cells are taken out, the
+  // thread that placed one may have looked before this copy was there.
+  bool keepsCopy(Set& set, KeyType k, int cell) {
+    for (int i = 0; i < cell; ++i) {
+      if (holds(set.cells[i].load(std::memory_order::memory_order_acquire), k)) {
+        takeOut(set, k, cell);
+        return false;
+      }
+    }
+    for (int i = cell + 1; i < Ways; ++i) {
+      takeOut(set, k, i);
+    }
+    return true;
+  }
+
+  void takeOut(Set& set, KeyType k, int cell) {
+    auto word = set.cells[cell].load(std::memory_order::memory_order_acquire);
+    while (holds(word, k) && !set.cells[cell].compare_exchange_weak(word, m_empty)) {}
+  }
+
+  int m_setCount;
+  uint64_t m_empty;
+  void* m_memory;
+  Set* m_sets;
+  // hits, misses, insertions and evictions, see striped_counters
+  striped_counters<Counters> m_counters;
+};
+
+#endif // CACHE_H
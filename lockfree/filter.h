@@ -0,0 +1,86 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Blocked Bloom filter over key hashes. Each key sets a few bits within one 512
+// bit block, so a lookup costs a single cache line whatever the filter's size.
+// Filters are written by one thread while they are built and only read once
+// complete() is true, the bits themselves need no atomics.
+class KeyFilter {
+  enum { BlockBits = 512, WordsPerBlock = BlockBits / 64, BitsPerKey = 12, BitsSet = 6 };
+
+  // 9 bits of the mixed hash per bit to set
+  static uint64_t mix(uint32_t hash) {
+    auto h = static_cast<uint64_t>(hash) * 0x9e3779b97f4a7c15ull;
+    return h ^ (h >> 29);
+  }
+
+  // from a multiplier of its own, so the block says nothing about the bits
+  uint64_t* blockOf(uint32_t hash) const {
+    auto h = (static_cast<uint64_t>(hash) * 0xc2b2ae3d27d4eb4full) >> 32;
+    return m_bits + (h * m_blocks >> 32) * WordsPerBlock;
+  }
+
+public:
+  // room for keys keys at about 1% false positives
+  explicit KeyFilter(int keys):
+    m_blocks(static_cast<uint64_t>(keys) * BitsPerKey / BlockBits + 1),
+    m_memory(new uint64_t[(m_blocks + 1) * WordsPerBlock]()),
+    m_bits(alignedBlocks(m_memory)), m_complete(false), m_scannedCells(0) {}
+
+  ~KeyFilter() {
+    delete[] m_memory;
+  }
+
+  KeyFilter(const KeyFilter&) = delete;
+  KeyFilter& operator=(const KeyFilter&) = delete;
+
+  void add(uint32_t hash) {
+    auto h = mix(hash);
+    auto block = blockOf(hash);
+    for (int i = 0; i < BitsSet; ++i) {
+      auto bit = (h >> (i * 9)) & (BlockBits - 1);
+      block[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
+    }
+  }
+
+  // pulls in the block of a hash ahead of add
+  void prefetch(uint32_t hash) const {
+    __builtin_prefetch(blockOf(hash), 1);
+  }
+
+  // false only if no key with this hash was added
+  bool mayContain(uint32_t hash) const {
+    auto h = mix(hash);
+    auto block = blockOf(hash);
+    for (int i = 0; i < BitsSet; ++i) {
+      auto bit = (h >> (i * 9)) & (BlockBits - 1);
+      if ((block[bit / 64] & (static_cast<uint64_t>(1) << (bit % 64))) == 0) return false;
+    }
+    return true;
+  }
+
+  // the builder publishes the bits with complete(), readers check it first
+  void complete() { m_complete.store(true, std::memory_order::memory_order_release); }
+  bool isComplete() const { return m_complete.load(std::memory_order::memory_order_acquire); }
+
+private:
+  // a block is a cache line, blocks start on one, the spare block makes up for the shift
+  static uint64_t* alignedBlocks(uint64_t* memory) {
+    auto address = reinterpret_cast<uintptr_t>(memory);
+    return reinterpret_cast<uint64_t*>((address + BlockBits / 8 - 1) & ~static_cast<uintptr_t>(BlockBits / 8 - 1));
+  }
+
+  uint64_t m_blocks;
+  uint64_t* m_memory;
+  uint64_t* m_bits;
+  std::atomic<bool> m_complete;
+
+public:
+  // cells of the filtered table that were added so far, kept by the builder
+  int m_scannedCells;
+};
+
+#endif // FILTER_H
@@ -1,147 +1,517 @@
 #ifndef __LOCKFREE_H
 #define __LOCKFREE_H
 
+#include <algorithm>
 #include <memory>
 #include <atomic>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+#include "reclamation.h"
+#include "stats.h"
 #include "table.h"
 
-template <typename Tkey, typename Tvalue, typename Tkey_traits = key_traits<Tvalue>, typename Tvalue_traits = value_traits<Tvalue>>
+// Ttable picks the table flavour, e.g. Table<K, V, key_traits<K, identity_hash>, value_traits<V>, pow2_indexing>.
+// Its traits are the ones the map works with.
+template <typename Tkey, typename Tvalue, typename Tkey_traits = key_traits<Tkey>, typename Tvalue_traits = value_traits<Tvalue>, typename Treclamation = epoch_reclamation,
+          typename Ttable = Table<Tkey, Tvalue, Tkey_traits, Tvalue_traits>>
 class LockFreeMap {
 public:
   using KeyType = Tkey;
   using ValueType = Tvalue;
   using KeyTraitsType = Tkey_traits;
   using ValueTraitsType = Tvalue_traits;
+  using ReclamationType = Treclamation;
+  using TableType = Ttable;
+  using CellType = typename TableType::CellType;
+  using GracePeriod = grace_period<ReclamationType>;
 
   LockFreeMap(): LockFreeMap(1000) {}
-  ~LockFreeMap() {}
 
-  LockFreeMap(int initialSize, double maxLoadFactor = 0.5, double growthFactor = 4.0): m_maxLoadFactor(maxLoadFactor), m_growthFactor(growthFactor) {
-    m_activeTable = new Table<Tkey, Tvalue>(initialSize, initialSize * maxLoadFactor);
+  // no operation may be in flight anymore, so everything left can go right away
+  ~LockFreeMap() {
+    for (auto t = m_oldTables.m_newest.load(); t != nullptr; ) {
+      auto older = t->m_olderTable.load();
+      delete t;
+      t = older;
+    }
+    delete m_activeTable.load();
   }
 
-  ValueType insert(KeyType k, ValueType v) {
-    Table<Tkey, Tvalue>* table = m_activeTable.load();
+  // A table that runs out of free cells with more than maxDeadFraction of them held
+  // by removed keys is compacted into a table of the same size instead of growing.
+  LockFreeMap(int initialSize, double maxLoadFactor = 0.5, double growthFactor = 4.0, double maxDeadFraction = 0.5):
+    m_maxLoadFactor(maxLoadFactor), m_growthFactor(growthFactor), m_maxDeadFraction(maxDeadFraction), m_iterations(0), m_movedValues(0) {
+    m_activeTable = newTable(initialSize);
+  }
 
-    auto insertionResult = insertWithoutAllocate(table, k, v);
-    switch (insertionResult) {
-      case InsertionResult::value_updated:
-        return v;
-      case InsertionResult::insertion_failed:
-        return ValueTraitsType::defaultValue();
-      case InsertionResult::key_inserted:
-        ++table->m_heldKeys;
-        if (--table->m_freeCells == 0) {
-          activateNewTable();
+  // Takes over table as the active table, e.g. one loaded by persistence.h. The
+  // table has to leave at least one free cell, or it would never grow.
+  LockFreeMap(TableType* table, double maxLoadFactor = 0.5, double growthFactor = 4.0, double maxDeadFraction = 0.5):
+    m_maxLoadFactor(maxLoadFactor), m_growthFactor(growthFactor), m_maxDeadFraction(maxDeadFraction), m_iterations(0), m_movedValues(0) {
+    if (table == nullptr) throw std::invalid_argument("table argument cannot be null");
+    if (table->m_freeCells <= 0) throw std::invalid_argument("table has no free cells left");
+    m_activeTable = table;
+  }
+
+  // A map of the pairs in [first, last), filled by bulkLoad. A forward range gets
+  // a table sized for it from the start, one that can only be read once grows as
+  // it is inserted.
+  template <typename Iterator, typename = typename std::iterator_traits<Iterator>::iterator_category>
+  LockFreeMap(Iterator first, Iterator last, double maxLoadFactor = 0.5, double growthFactor = 4.0, double maxDeadFraction = 0.5):
+    LockFreeMap(sizeForKeys(countOf(first, last, typename std::iterator_traits<Iterator>::iterator_category()), maxLoadFactor),
+                maxLoadFactor, growthFactor, maxDeadFraction) {
+    bulkLoad(first, last);
+  }
+
+  double maxLoadFactor() const {
+    return m_maxLoadFactor;
+  }
+
+  // Makes room for keys more keys at once. An active table that can't take them
+  // is retired into one sized for them and for the keys the map holds, so they go
+  // in without growing the table over and over. The keys it held move over as in
+  // any resize, and so do the keys of old tables that are still to be drained,
+  // they take free cells of the active table as well. Writers that come in
+  // meanwhile can still use up the room.
+  void reserve(long long keys) {
+    typename ReclamationType::guard guard;
+    for (;;) {
+      std::vector<TableType*> tables;
+      snapshotTables(tables);
+      TableType* table = tables.front();
+
+      long long held = 0;
+      for (auto t : tables) {
+        held += std::max(0, t->m_heldKeys.load(std::memory_order::memory_order_relaxed));
+      }
+      auto migrating = held - std::max(0, table->m_heldKeys.load(std::memory_order::memory_order_relaxed));
+      if (table->m_freeCells.load() > keys + migrating) return;
+
+      // a table that got retired meanwhile has no free cells left to take
+      if (table->m_freeCells.exchange(0) > 0) {
+        activateNewTable(table, false, sizeForKeys(held + keys, m_maxLoadFactor));
+        return;
+      }
+    }
+  }
+
+  // Inserts the pairs of [first, last) after reserving room for all of them. Random
+  // access ranges are split into chunks that threads insert in parallel, threads
+  // defaults to the number of cores, other ranges are inserted by the calling
+  // thread. With threads, which value a key that comes up more than once ends up
+  // with is up to them.
+  template <typename Iterator, typename = typename std::iterator_traits<Iterator>::iterator_category>
+  void bulkLoad(Iterator first, Iterator last, int threads = 0) {
+    loadRange(first, last, threads, typename std::iterator_traits<Iterator>::iterator_category());
+  }
+
+  // bulkLoad of count pairs that generate(i) makes up, for i from 0 to count - 1.
+  // generate is called concurrently, and returns anything with first and second.
+  template <typename F>
+  void bulkLoad(size_t count, F generate, int threads = 0) {
+    if (threads <= 0) threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    reserve(static_cast<long long>(count));
+
+    std::atomic<size_t> nextChunk(0);
+    auto chunks = (count + BulkChunkSize - 1) / BulkChunkSize;
+    auto work = [&]() {
+      KeyType keys[BulkBatchSize];
+      ValueType values[BulkBatchSize];
+      for (auto chunk = nextChunk++; chunk < chunks; chunk = nextChunk++) {
+        auto end = std::min(count, (chunk + 1) * BulkChunkSize);
+        for (auto begin = chunk * BulkChunkSize; begin < end; begin += BulkBatchSize) {
+          auto n = std::min(end - begin, static_cast<size_t>(BulkBatchSize));
+          for (size_t i = 0; i < n; ++i) {
+            auto pair = generate(begin + i);
+            keys[i] = pair.first;
+            values[i] = pair.second;
+          }
+          insertMany(keys, values, n);
         }
+      }
+    };
 
-        return v;
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads && static_cast<size_t>(i) < chunks; ++i) {
+      workers.emplace_back(work);
     }
+    work();
+    for (auto& w : workers) w.join();
+  }
+
+  ValueType insert(KeyType k, ValueType v) {
+    typename ReclamationType::guard guard;
+    helpMigrate();
+
+    m_stats.onInsert();
+    return insertHashed(k, KeyTraitsType::hash(k), v);
   }
 
   ValueType get(KeyType k) {
-    Table<Tkey, Tvalue>* activeTable = m_activeTable.load();
-    auto cell = activeTable->findFirstCellFor(k);
+    typename ReclamationType::guard guard;
+    helpMigrate();
 
-    if (cell != nullptr) {
-      return cell->value.load(std::memory_order::memory_order_relaxed);
-    }
+    m_stats.onGet();
+    return getHashed(k, KeyTraitsType::hash(k));
+  }
+
+  // The batch versions hash a group of keys and prefetch their home cells before
+  // probing any of them, so the cache misses of the whole group overlap instead of
+  // being paid one key at a time.
+  void insertMany(const KeyType* keys, const ValueType* values, size_t n) {
+    typename ReclamationType::guard guard;
+    uint32_t hashes[BatchSize];
+
+    for (size_t begin = 0; begin < n; begin += BatchSize) {
+      helpMigrate();
+      auto count = std::min(n - begin, static_cast<size_t>(BatchSize));
 
-    auto v = m_oldTables.getValueHistorically(k);
-    if (InsertionResult::insertion_failed != insertWithoutAllocate(activeTable, k, v)) {
-      m_oldTables.removeValueHistorically(k);
+      TableType* table = m_activeTable.load();
+      for (size_t i = 0; i < count; ++i) {
+        hashes[i] = KeyTraitsType::hash(keys[begin + i]);
+        table->prefetch(hashes[i], true);
+      }
+
+      for (size_t i = 0; i < count; ++i) {
+        m_stats.onInsert();
+        insertHashed(keys[begin + i], hashes[i], values[begin + i]);
+      }
     }
+  }
 
-    return v;
+  void getMany(const KeyType* keys, ValueType* values, size_t n) {
+    typename ReclamationType::guard guard;
+    uint32_t hashes[BatchSize];
+
+    for (size_t begin = 0; begin < n; begin += BatchSize) {
+      helpMigrate();
+      auto count = std::min(n - begin, static_cast<size_t>(BatchSize));
+
+      TableType* table = m_activeTable.load();
+      for (size_t i = 0; i < count; ++i) {
+        hashes[i] = KeyTraitsType::hash(keys[begin + i]);
+        table->prefetch(hashes[i], false);
+      }
+
+      for (size_t i = 0; i < count; ++i) {
+        m_stats.onGet();
+        values[begin + i] = getHashed(keys[begin + i], hashes[i]);
+      }
+    }
   }
 
   ValueType remove(KeyType k) {
-    Table<Tkey, Tvalue>* table = m_activeTable;
+    typename ReclamationType::guard guard;
+    helpMigrate();
 
-    auto cell = table->findFirstCellFor(k);
+    m_stats.onRemove();
+    for (;;) {
+      auto moves = m_movedValues.load(std::memory_order::memory_order_acquire);
+      auto value = takeValue(m_activeTable.load(), k);
+
+      // an older copy would otherwise come back with the migration
+      auto oldValue = m_oldTables.removeValueHistorically(k);
+      if (value != ValueTraitsType::defaultValue()) return value;
+      if (oldValue != ValueTraitsType::defaultValue() || !movedSince(moves)) return oldValue;
+    }
+  }
+
+  // Read-modify-write operations. Each one runs a CAS loop on the cell that holds
+  // the key's current value, a missing key reads as the default value. Writing the
+  // default value removes the key.
+
+  // stores f(current) and returns it
+  template <typename F>
+  ValueType upsert(KeyType k, F f) {
+    ValueType previous, next;
+    modify(k, [&f](ValueType current, ValueType& desired) { desired = f(current); return true; }, previous, next);
+    return next;
+  }
+
+  // adds delta and returns the value before
+  ValueType fetchAdd(KeyType k, ValueType delta) {
+    static_assert(std::is_arithmetic<ValueType>::value, "fetchAdd needs an arithmetic value type");
+
+    ValueType previous, next;
+    modify(k, [delta](ValueType current, ValueType& desired) { desired = current + delta; return true; }, previous, next);
+    return previous;
+  }
+
+  // stores desired if the value is expected, otherwise expected gets the value
+  bool compareExchange(KeyType k, ValueType& expected, ValueType desired) {
+    ValueType previous, next;
+    auto written = modify(k, [expected, desired](ValueType current, ValueType& d) { d = desired; return current == expected; }, previous, next);
+    if (!written) {
+      expected = previous;
+    }
+    return written;
+  }
+
+  // The key the map keeps for k, the default value if there is none. Keys whose
+  // traits compare them by contents can be equal without being the same, this
+  // hands out the one that is already stored.
+  KeyType storedKey(KeyType k) {
+    typename ReclamationType::guard guard;
 
+    auto hash = KeyTraitsType::hash(k);
+    auto cell = m_activeTable.load()->findFirstCellFor(k, hash);
     if (cell == nullptr) {
-      return ValueTraitsType::defaultValue();
+      TableType* owner;
+      cell = m_oldTables.findNewestCellFor(k, hash, &owner);
     }
+    return cell == nullptr ? KeyTraitsType::defaultValue() : cell->key.load(std::memory_order::memory_order_acquire);
+  }
 
-    auto value = cell->value.exchange(ValueTraitsType::defaultValue(), std::memory_order::memory_order_relaxed);
+  // all zeros unless built with LOCKFREE_ENABLE_STATS
+  MapStatsSnapshot stats() const {
+    return m_stats.snapshot();
+  }
 
-    if (value != ValueTraitsType::defaultValue()) {
-      --table->m_heldKeys;
+  // Iteration reports every key that holds a value, each key at most once, along
+  // with the value it finds. It is weakly consistent: a key that is in the map and
+  // left alone the whole time is reported, writes made meanwhile may or may not
+  // show. A key written meanwhile can be missed while its value waits in an old
+  // table. Migration pauses while iterations run, so no value moves from a table
+  // that is still to be scanned into one that was scanned already.
+  // Don't iterate from inside a guard or an operation of the map, the pause waits
+  // for every operation that may still be migrating to finish.
+
+  // f(key, value) for every key
+  template <typename F>
+  void forEach(F f) {
+    Iteration iteration(this);
+    for (size_t t = 0; t < iteration.m_tables.size(); ++t) {
+      scan(iteration.m_tables, t, 0, iteration.m_tables[t]->m_size, f);
     }
+  }
 
-    return value;
+  // forEach with the cells split into chunks that threads scan in parallel, f is
+  // called concurrently. threads defaults to the number of cores.
+  template <typename F>
+  void parallelForEach(F f, int threads = 0) {
+    if (threads <= 0) threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+    Iteration iteration(this);
+    auto& tables = iteration.m_tables;
+
+    // chunks are numbered across all tables, table t starts at chunk firstChunk[t]
+    std::vector<int> firstChunk(tables.size() + 1, 0);
+    for (size_t t = 0; t < tables.size(); ++t) {
+      firstChunk[t + 1] = firstChunk[t] + (tables[t]->m_size + IterationChunkSize - 1) / IterationChunkSize;
+    }
+
+    std::atomic<int> nextChunk(0);
+    auto work = [&]() {
+      size_t t = 0;
+      for (auto chunk = nextChunk++; chunk < firstChunk.back(); chunk = nextChunk++) {
+        while (chunk >= firstChunk[t + 1]) ++t;
+
+        auto begin = (chunk - firstChunk[t]) * IterationChunkSize;
+        scan(tables, t, begin, std::min(begin + static_cast<int>(IterationChunkSize), tables[t]->m_size), f);
+      }
+    };
+
+    // the tables stay pinned by this thread's guard, the workers only read them
+    std::vector<std::thread> workers;
+    for (int i = 1; i < threads; ++i) {
+      workers.emplace_back(work);
+    }
+    work();
+    for (auto& w : workers) w.join();
+  }
+
+  // An iteration as a range of std::pair<KeyType, ValueType>. Migration stays paused
+  // and the tables pinned for as long as the Iteration lives, so keep it to the loop.
+  class Iteration {
+  public:
+    using value_type = std::pair<KeyType, ValueType>;
+
+    class iterator {
+    public:
+      using iterator_category = std::input_iterator_tag;
+      using value_type = std::pair<KeyType, ValueType>;
+      using difference_type = std::ptrdiff_t;
+      using pointer = const value_type*;
+      using reference = const value_type&;
+
+      iterator(): m_tables(nullptr), m_table(0), m_idx(0) {}
+
+      reference operator*() const { return m_current; }
+      pointer operator->() const { return &m_current; }
+
+      iterator& operator++() {
+        ++m_idx;
+        settle();
+        return *this;
+      }
+
+      bool operator==(const iterator& other) const { return atEnd() == other.atEnd() && (atEnd() || (m_table == other.m_table && m_idx == other.m_idx)); }
+      bool operator!=(const iterator& other) const { return !(*this == other); }
+
+    private:
+      friend class Iteration;
+
+      explicit iterator(const std::vector<TableType*>* tables): m_tables(tables), m_table(0), m_idx(0) { settle(); }
+
+      bool atEnd() const { return m_tables == nullptr || m_table == m_tables->size(); }
+
+      // moves on to the next cell that is to be reported, starting at this one
+      void settle() {
+        for (; m_table < m_tables->size(); ++m_table, m_idx = 0) {
+          for (; m_idx < (*m_tables)[m_table]->m_size; ++m_idx) {
+            if (reportable(*m_tables, m_table, m_idx, m_current.first, m_current.second)) return;
+          }
+        }
+      }
+
+      const std::vector<TableType*>* m_tables;
+      size_t m_table;
+      int m_idx;
+      value_type m_current;
+    };
+
+    explicit Iteration(LockFreeMap* map): m_map(map) {
+      m_map->pauseMigration();
+      m_guard.reset(new typename ReclamationType::guard());
+      m_map->snapshotTables(m_tables);
+    }
+
+    Iteration(Iteration&& other): m_map(other.m_map), m_guard(std::move(other.m_guard)), m_tables(std::move(other.m_tables)) {
+      other.m_map = nullptr;
+    }
+
+    ~Iteration() {
+      m_guard.reset();
+      if (m_map != nullptr) m_map->resumeMigration();
+    }
+
+    Iteration(const Iteration&) = delete;
+    Iteration& operator=(const Iteration&) = delete;
+
+    iterator begin() const { return iterator(&m_tables); }
+    iterator end() const { return iterator(); }
+
+    // New keys go into the first table the iteration scans until its free cells
+    // run out, so a pass reports at most about this many keys more than one before.
+    int freeCells() const { return std::max(0, m_tables.front()->m_freeCells.load()); }
+
+  private:
+    friend class LockFreeMap;
+
+    LockFreeMap* m_map;
+    std::unique_ptr<typename ReclamationType::guard> m_guard;
+    std::vector<TableType*> m_tables;
+  };
+
+  Iteration iterate() {
+    return Iteration(this);
   }
 
 private:
+  // Retired tables, chained newest first through their m_olderTable links. Tables
+  // are pushed at the front by the thread that retires them, and unlinked wherever
+  // they are once drained, by the holder of the migration transaction. That is
+  // the only thread writing the links of tables in the chain, so only the front
+  // needs a CAS. Readers may still walk through a table that was unlinked, it is
+  // retired to the reclamation policy and keeps its link to the older tables.
   struct OldTablesContainer {
-    OldTablesContainer(int size = 100) : m_size(size), m_totalTables(0), m_head(0), m_tail(0), m_isMigrating(false) {
-      m_data = new Table<Tkey, Tvalue>*[m_size];
-    }
+    OldTablesContainer() : m_newest(nullptr), m_isMigrating(false) {}
 
     bool empty() {
-      return m_totalTables == 0;
+      return m_newest.load() == nullptr;
     }
 
-    bool full() {
-      return m_totalTables == m_size;
+    void insert(TableType* t) {
+      auto newest = m_newest.load();
+      do {
+        t->m_olderTable.store(newest, std::memory_order::memory_order_relaxed);
+      } while (!m_newest.compare_exchange_weak(newest, t));
     }
 
-    bool insert(Table<Tkey, Tvalue>* t){
-      while (!full()) {
-        auto currTail = m_tail.load(std::memory_order::memory_order_relaxed);
-        auto newTail = (currTail + 1) % m_size;
-        if (m_tail.compare_exchange_strong(currTail, newTail)) {
-          ++m_totalTables;
-          m_data[currTail] = t;
-          return true;
+    // Unlinks the drained tables and hands each to retire. Only with the migration
+    // transaction, or once nothing else touches the container.
+    template <typename F>
+    void unlinkDrained(F retire) {
+      auto link = &m_newest;
+      auto t = link->load();
+      while (t != nullptr) {
+        auto older = t->m_olderTable.load();
+        if (!isDrained(t)) {
+          link = &t->m_olderTable;
+          t = older;
+        } else if (link->compare_exchange_strong(t, older)) {
+          retire(t);
+          t = older;
         }
+        // else a table was pushed in front, t is the newest now
       }
-      return false;
+    }
 
+    // the newest table that still has cells to migrate, nullptr if all are drained
+    TableType* peekNewestUndrained() {
+      for (auto t = m_newest.load(); t != nullptr; t = t->m_olderTable.load()) {
+        if (!isDrained(t)) return t;
+      }
+      return nullptr;
     }
 
-    Table<Tkey, Tvalue>* discardOldest() {
-      while (!empty()) {
-        auto currHead = m_head.load(std::memory_order::memory_order_relaxed);
-        auto newHead = (currHead + 1) % m_size;
-        if (m_head.compare_exchange_strong(currHead, newHead)) {
-          --m_totalTables;
-          return m_data[currHead];
+    // newer tables hold newer values, so the first live cell from the newest side wins
+    CellType findNewestCellFor(KeyType k, uint32_t hash, TableType** owner) {
+      for (auto t = m_newest.load(); t != nullptr; t = t->m_olderTable.load()) {
+        if (isDrained(t) || !mayHold(t, hash)) continue;
+
+        auto cell = t->findFirstCellFor(k, hash);
+        if (cell != nullptr && cell->value.load() != ValueTraitsType::defaultValue()) {
+          *owner = t;
+          return cell;
         }
       }
+
       return nullptr;
     }
 
-    Table<Tkey, Tvalue>* peekOldest() {
-      auto currHead = m_head.load(std::memory_order::memory_order_relaxed);
-      return m_data[currHead];
+    // the tables that still hold cells, newest first
+    void appendNewestFirst(std::vector<TableType*>& tables) {
+      for (auto t = m_newest.load(); t != nullptr; t = t->m_olderTable.load()) {
+        if (!isDrained(t)) tables.push_back(t);
+      }
     }
 
     ValueType getValueHistorically(KeyType k) {
+      TableType* owner;
+      auto cell = findNewestCellFor(k, KeyTraitsType::hash(k), &owner);
+      return cell == nullptr ? ValueTraitsType::defaultValue() : cell->value.load();
+    }
+
+    // returns the newest value that was removed
+    ValueType removeValueHistorically(KeyType k) {
       auto v = ValueTraitsType::defaultValue();
-      for (auto i = m_head.load(std::memory_order::memory_order_seq_cst); i < m_tail.load(); ++i) {
-        auto t = m_data[i];
-        auto cell = t->findFirstCellFor(k);
+      auto hash = KeyTraitsType::hash(k);
+      for (auto t = m_newest.load(); t != nullptr; t = t->m_olderTable.load()) {
+        if (!mayHold(t, hash)) continue;
+
+        auto cell = t->findFirstCellFor(k, hash);
         if (cell != nullptr) {
-          v = cell->value.load();
+          auto oldValue = cell->value.exchange(ValueTraitsType::defaultValue());
+          if (oldValue != ValueTraitsType::defaultValue()) {
+            t->m_heldKeys--;
+            if (v == ValueTraitsType::defaultValue()) v = oldValue;
+          }
         }
       }
-
       return v;
     }
 
-    void removeValueHistorically(KeyType k) {
-      for (auto i = m_head.load(std::memory_order::memory_order_seq_cst); i < m_tail.load(); ++i) {
-        auto t = m_data[i];
-        auto cell = t->findFirstCellFor(k);
-        if (cell != nullptr) {
-          cell->key.store(KeyTraitsType::defaultValue(), std::memory_order::memory_order_relaxed);
-          cell->value.store(ValueTraitsType::defaultValue(), std::memory_order::memory_order_relaxed);
-          t->m_heldKeys--;
-        }
-      }
+    // a plain look first, so helpers don't all bounce the line with a CAS
+    bool isMigrating() {
+      return m_isMigrating.load(std::memory_order::memory_order_relaxed);
     }
 
     bool startMigrationTransaction() {
@@ -149,15 +519,13 @@ private:
       return m_isMigrating.compare_exchange_strong(v, true);
     }
 
+    // Releases what the holder wrote without atomics, the filter it built and the
+    // links it rewrote, to the next holder, whose CAS acquires them.
     void endTransaction() {
-      m_isMigrating.store(false, std::memory_order::memory_order_relaxed);
+      m_isMigrating.store(false, std::memory_order::memory_order_release);
     }
 
-    Table<Tkey, Tvalue>** m_data;
-    int m_size;
-    std::atomic<int> m_totalTables;
-    std::atomic<int> m_head;
-    std::atomic<int> m_tail;
+    std::atomic<TableType*> m_newest;
     std::atomic<bool> m_isMigrating;
   };
 
@@ -175,49 +543,561 @@ private:
     value_updated, key_inserted, insertion_failed
   };
 
+  // number of cells an operation migrates when old tables are around
+  static const int MigrationChunkSize = 64;
+
+  // cells an operation adds to the filter of a settled table. Each key sets bits in
+  // a random line of the filter, a cache miss once the filter outgrows the cache,
+  // the lines of a chunk are prefetched together before any bit is set.
+  enum { FilterChunkSize = 256 };
+
+  // keys whose home cells are prefetched together by the batch operations
+  static const int BatchSize = 16;
+
+  // cells a thread of parallelForEach scans at a time
+  enum { IterationChunkSize = 1 << 14 };
+
+  // pairs a thread of bulkLoad takes at a time, and hands to insertMany at a time
+  enum { BulkChunkSize = 1 << 14, BulkBatchSize = 256 };
+
+  // most yields modify backs off with between looks at an old table's grace period
+  enum { MaxBackoffYields = 64 };
+
   double m_maxLoadFactor;
   double m_growthFactor;
+  double m_maxDeadFraction;
 
-  std::atomic<Table<Tkey, Tvalue>*> m_activeTable;
+  std::atomic<TableType*> m_activeTable;
   OldTablesContainer m_oldTables;
+  std::atomic<int> m_iterations;
+  std::atomic<uint64_t> m_movedValues;
+  map_stats m_stats;
 
   // migration
 
-  void activateNewTable() {
-    Table<Tkey, Tvalue>* currentTable = m_activeTable.load();
-    auto newSize = static_cast<int>(currentTable->m_size * m_growthFactor);
+  ValueType insertHashed(KeyType k, uint32_t hash, ValueType v) {
+    for (;;) {
+      TableType* table = m_activeTable.load();
+
+      bool claimed;
+      auto insertionResult = insertWithoutAllocate(table, k, hash, v, claimed);
+      m_stats.onProbe();
+      if (insertionResult == InsertionResult::insertion_failed) {
+        onOverflow(table);
+        continue;
+      }
+
+      onInserted(table, insertionResult == InsertionResult::key_inserted, claimed);
 
-    auto newTable = new Table<Tkey, Tvalue>(newSize, newSize * m_maxLoadFactor);
+      // if the table got retired while we were writing, the migration may already
+      // be past our cell, so the write has to be repeated on the active table
+      if (table == m_activeTable.load()) {
+        return v;
+      }
+    }
+  }
+
+  // Only loads, unless a live value is found in an old table and promoted to the
+  // active one. A miss writes nothing, so readers keep their cache lines shared.
+  // A miss in the active table and then in the old ones can straddle the migration
+  // of the key from an older table to a newer one, the lookup starts over if any
+  // value moved meanwhile.
+  ValueType getHashed(KeyType k, uint32_t hash) {
+    for (;;) {
+      auto moves = m_movedValues.load(std::memory_order::memory_order_acquire);
+      TableType* activeTable = m_activeTable.load();
+      auto cell = activeTable->findFirstCellFor(k, hash);
+      m_stats.onProbe();
+
+      if (cell != nullptr) {
+        auto v = cell->value.load(std::memory_order::memory_order_relaxed);
+        if (v != ValueTraitsType::defaultValue()) {
+          return v;
+        }
+      }
+      if (m_oldTables.empty()) {
+        if (!movedSince(moves)) return ValueTraitsType::defaultValue();
+        continue;
+      }
+
+      m_stats.onOldTableLookup();
+      TableType* oldTable = nullptr;
+      auto oldCell = m_oldTables.findNewestCellFor(k, hash, &oldTable);
+      // the value found may have moved on since
+      auto v = oldCell == nullptr ? ValueTraitsType::defaultValue() : oldCell->value.load(std::memory_order::memory_order_acquire);
+      if (v != ValueTraitsType::defaultValue()) {
+        if (mayMigrate(oldTable)) {
+          migrateCell(oldTable, oldCell, activeTable);
+        }
+        return v;
+      }
+
+      if (!movedSince(moves)) {
+        return v;
+      }
+    }
+  }
+
+  // Migration counts a value as moved after it landed in the new table and before
+  // it leaves the old one. So a lookup that missed the value everywhere while it
+  // moved sees the count go up.
+  bool movedSince(uint64_t moves) {
+    return m_movedValues.load(std::memory_order::memory_order_acquire) != moves;
+  }
+
+  // takes the value of k out of table, the default value if it had none
+  ValueType takeValue(TableType* table, KeyType k) {
+    auto value = ValueTraitsType::defaultValue();
+    auto cell = table->findFirstCellFor(k);
+    m_stats.onProbe();
+
+    if (cell != nullptr) {
+      value = cell->value.exchange(ValueTraitsType::defaultValue(), std::memory_order::memory_order_relaxed);
+      if (value != ValueTraitsType::defaultValue()) {
+        --table->m_heldKeys;
+      }
+    }
+    return value;
+  }
+
+  TableType* newTable(int size) {
+    auto capacity = TableType::capacityFor(size);
+    return new TableType(capacity, allowedCells(capacity));
+  }
+
+  // A size whose table takes keys without retiring. The last free cell going
+  // retires a table, hence one cell to spare.
+  static int sizeForKeys(long long keys, double maxLoadFactor) {
+    auto size = std::ceil((keys + 1) / maxLoadFactor) + 1;
+    if (size > std::numeric_limits<int>::max()) throw std::invalid_argument("too many keys for a table");
+    return static_cast<int>(size);
+  }
+
+  template <typename Iterator>
+  static long long countOf(Iterator first, Iterator last, std::forward_iterator_tag) {
+    return std::distance(first, last);
+  }
+
+  template <typename Iterator>
+  static long long countOf(Iterator, Iterator, std::input_iterator_tag) {
+    return 0;
+  }
+
+  template <typename Iterator>
+  void loadRange(Iterator first, Iterator last, int threads, std::random_access_iterator_tag) {
+    bulkLoad(static_cast<size_t>(last - first), [first](size_t i) { return first[i]; }, threads);
+  }
+
+  template <typename Iterator>
+  void loadRange(Iterator first, Iterator last, int, std::input_iterator_tag) {
+    for (; first != last; ++first) {
+      insert(first->first, first->second);
+    }
+  }
+
+  // a table that allows no insertion at all would never trigger its own growth
+  int allowedCells(int capacity) const {
+    return std::max(1, static_cast<int>(capacity * m_maxLoadFactor));
+  }
+
+  // A table whose cells mostly hold tombstones when it runs out of free ones is
+  // rehashed into a table of the same size. The migration only carries live values
+  // over, so under insert/remove churn the map keeps its size and its probes stay
+  // short, instead of growing for keys that are long gone.
+  // A table that overflowed always grows, the same size could overflow all over again.
+  // The new table has at least minSize cells.
+  void activateNewTable(TableType* currentTable, bool overflowed = false, int minSize = 0) {
+    auto start = map_stats::now();
+    auto liveCells = currentTable->m_heldKeys.load(std::memory_order::memory_order_relaxed);
+    auto compact = !overflowed && minSize <= currentTable->m_size &&
+                   liveCells <= allowedCells(currentTable->m_size) * (1.0 - m_maxDeadFraction);
+
+    auto size = compact ? currentTable->m_size : static_cast<int>(currentTable->m_size * m_growthFactor);
+    auto table = newTable(std::max(size, minSize));
+    m_stats.onResize(map_stats::now() - start);
+    if (compact) {
+      m_stats.onCompaction();
+    }
 
     m_oldTables.insert(currentTable);
-    m_activeTable = newTable;
+    m_activeTable = table;
+    currentTable->m_retiredAt.store(GracePeriod::now());
   }
 
-  InsertionResult insertWithoutAllocate(Table<Tkey, Tvalue>* table, KeyType k, ValueType v) {
-    auto cell = table->fillFirstCellFor(k);
-    if (cell == nullptr) {
+  // Writers that took the table for the active one may still be writing to it
+  // until its grace period is over. Its cells are only moved out after that.
+  static bool isSettled(TableType* table) {
+    auto retiredAt = table->m_retiredAt.load();
+    return retiredAt != std::numeric_limits<uint64_t>::max() && GracePeriod::passed(retiredAt);
+  }
+
+  // false if the table's filter rules out every key with this hash
+  static bool mayHold(TableType* table, uint32_t hash) {
+    auto filter = table->m_filter.load(std::memory_order::memory_order_acquire);
+    return filter == nullptr || !filter->isComplete() || filter->mayContain(hash);
+  }
+
+  // Settled tables take no new keys, so their filter is built once, a chunk at a
+  // time by whoever holds the migration transaction. Returns whether it is complete.
+  static bool buildFilter(TableType* table) {
+    auto filter = table->m_filter.load(std::memory_order::memory_order_relaxed);
+    if (filter == nullptr) {
+      filter = new KeyFilter(std::max(1, table->m_heldKeys.load()));
+      table->m_filter.store(filter, std::memory_order::memory_order_release);
+    }
+    if (filter->isComplete()) return true;
+
+    uint32_t hashes[FilterChunkSize];
+    auto count = 0;
+    auto end = std::min(table->m_size, filter->m_scannedCells + static_cast<int>(FilterChunkSize));
+    for (auto idx = filter->m_scannedCells; idx < end; ++idx) {
+      auto cell = table->cellAt(idx);
+      auto k = cell->key.load(std::memory_order::memory_order_acquire);
+      if (k == KeyTraitsType::defaultValue()) continue;
+      if (cell->value.load(std::memory_order::memory_order_relaxed) != ValueTraitsType::defaultValue()) {
+        hashes[count] = KeyTraitsType::hash(k);
+        filter->prefetch(hashes[count++]);
+      }
+    }
+    for (auto i = 0; i < count; ++i) {
+      filter->add(hashes[i]);
+    }
+    filter->m_scannedCells = end;
+
+    if (end < table->m_size) return false;
+    filter->complete();
+    return true;
+  }
+
+  bool migrationPaused() {
+    return m_iterations.load() != 0;
+  }
+
+  bool mayMigrate(TableType* table) {
+    return !migrationPaused() && isSettled(table);
+  }
+
+  // Operations check for iterations under their guard before they migrate, so once
+  // a grace period passed after the count went up, none of them is migrating.
+  void pauseMigration() {
+    ++m_iterations;
+    auto token = GracePeriod::now();
+    while (!GracePeriod::passed(token)) {
+      std::this_thread::yield();
+    }
+  }
+
+  void resumeMigration() {
+    --m_iterations;
+  }
+
+  // Yields, twice as often each time, so a thread waiting for a grace period to end
+  // doesn't walk the thread records over and over while it can't have ended.
+  static void backOff(int& yields) {
+    for (auto i = 0; i < yields; ++i) {
+      std::this_thread::yield();
+    }
+    yields = std::min(yields * 2, static_cast<int>(MaxBackoffYields));
+  }
+
+  // the active table first, then the old ones from the newest
+  void snapshotTables(std::vector<TableType*>& tables) {
+    tables.push_back(m_activeTable.load());
+    m_oldTables.appendNewestFirst(tables);
+  }
+
+  // A cell is reported if it holds a value and its key has no cell in a newer table.
+  // Keys never leave their cells, so a key reported from one table is skipped in
+  // every older one.
+  static bool reportable(const std::vector<TableType*>& tables, size_t t, int idx, KeyType& k, ValueType& v) {
+    auto cell = tables[t]->cellAt(idx);
+    k = cell->key.load(std::memory_order::memory_order_acquire);
+    if (k == KeyTraitsType::defaultValue()) return false;
+
+    v = cell->value.load(std::memory_order::memory_order_acquire);
+    if (v == ValueTraitsType::defaultValue()) return false;
+
+    for (size_t newer = 0; newer < t; ++newer) {
+      if (tables[newer]->findFirstCellFor(k) != nullptr) return false;
+    }
+    return true;
+  }
+
+  template <typename F>
+  static void scan(const std::vector<TableType*>& tables, size_t t, int begin, int end, F& f) {
+    KeyType k;
+    ValueType v;
+    for (auto idx = begin; idx < end; ++idx) {
+      if (reportable(tables, t, idx, k, v)) f(k, v);
+    }
+  }
+
+  // A key that got a value is held, a cell taken from the empty ones is used up for
+  // good, whatever happens to its key later. The thread that uses up the last free
+  // cell retires the table.
+  void onInserted(TableType* table, bool keyInserted, bool cellClaimed) {
+    if (keyInserted) {
+      ++table->m_heldKeys;
+    }
+    if (cellClaimed && --table->m_freeCells == 0) {
+      activateNewTable(table);
+    }
+  }
+
+  // A key found no cell in table, which is full or, with a bounded probing policy,
+  // has none left near the key's home. Whoever takes its remaining free cells away
+  // retires it early, later decrements leave the count below 0 and never retire it
+  // again. A table that was retired already is left alone, callers move on to the
+  // active one.
+  void onOverflow(TableType* table) {
+    m_stats.onFailedInsertion();
+    if (table->m_freeCells.exchange(0) > 0) {
+      activateNewTable(table, true);
+    }
+  }
+
+  InsertionResult insertWithoutAllocate(TableType* table, KeyType k, uint32_t hash, ValueType v, bool& claimed) {
+    auto prev = ValueTraitsType::defaultValue();
+    if (table->insertOrAssign(k, hash, v, prev, claimed) == nullptr) {
       return InsertionResult::insertion_failed;
     }
 
-    auto prev = cell->value.exchange(v, std::memory_order::memory_order_release);
     return prev == ValueTraitsType::defaultValue() ? InsertionResult::key_inserted : InsertionResult::value_updated;
   }
 
-  bool migrateFirstElements(Table<Tkey, Tvalue>* fromTable, Table<Tkey, Tvalue>* toTable, int n) {
-    auto migratedElements = 0;
-    for (auto i = 0; i < fromTable->m_size; ++i) {
-      if (migratedElements >= n) return false;
-      if (fromTable->m_data[i].key == KeyTraitsType::defaultValue()) continue;
+  static bool isDrained(TableType* table) {
+    return table->m_migratedCells.load(std::memory_order::memory_order_acquire) >= table->m_size;
+  }
 
-      auto v = m_oldTables.getValueHistorically(fromTable->m_data[i].key);
-      if (v == ValueTraitsType::defaultValue()) continue;
+  // Every operation lends a hand: whoever gets the migration transaction moves the
+  // next chunk of cells of the newest old table. Migrating newest first means a
+  // stale copy in an older table never overrides a newer value. Drained tables are
+  // unlinked wherever they are in the chain and freed when no reader can hold them.
+  // Nobody asks for the transaction while there is nothing to do with it: during an
+  // iteration, or while the newest table with cells is in its grace period.
+  void helpMigrate() {
+    if (m_oldTables.empty() || migrationPaused() || m_oldTables.isMigrating()) {
+      return;
+    }
+    auto newest = m_oldTables.peekNewestUndrained();
+    if ((newest != nullptr && !isSettled(newest)) || !m_oldTables.startMigrationTransaction()) {
+      return;
+    }
+    AutoCloseMigration autoClose(&m_oldTables);
 
-      insertWithoutAllocate(toTable, fromTable->m_data[i].key, v);
-      m_oldTables.removeValueHistorically(fromTable->m_data[i].key);
-      migratedElements++;
+    // older tables wait as well, or their stale copies would take the cells first
+    auto fromTable = m_oldTables.peekNewestUndrained();
+    if (fromTable != nullptr && isSettled(fromTable) && buildFilter(fromTable) && !migrationPaused()) {
+      migrateFirstElements(fromTable, m_activeTable.load(), MigrationChunkSize);
     }
 
-    return true;
+    m_oldTables.unlinkDrained([](TableType* t) { ReclamationType::retire(t); });
+  }
+
+  // Moves a live value into toTable. The old cell is only cleared after the value
+  // landed. If toTable already had a value for the key, that one is newer and the
+  // old cell is left alone, shadowed by it. If the old cell changes in between, a
+  // remove takes the copy back out and a new value is carried over as well.
+  // Returns false if toTable has no room left for the key, which retires it.
+  bool migrateCell(TableType* fromTable, CellType fromCell, TableType* toTable) {
+    auto v = fromCell->value.load(std::memory_order::memory_order_acquire);
+    if (v == ValueTraitsType::defaultValue()) {
+      return true;
+    }
+
+    auto k = fromCell->key.load(std::memory_order::memory_order_acquire);
+    bool claimed;
+    auto toCell = toTable->fillFirstCellFor(k, KeyTraitsType::hash(k), claimed);
+    if (toCell == nullptr) {
+      onOverflow(toTable);
+      return false;
+    }
+
+    auto empty = ValueTraitsType::defaultValue();
+    if (!toCell->value.compare_exchange_strong(empty, v)) {
+      m_stats.onCasFailure();
+      onInserted(toTable, false, claimed);
+      return true;
+    }
+    onInserted(toTable, true, claimed);
+    m_movedValues.fetch_add(1);
+
+    for (;;) {
+      auto expected = v;
+      if (fromCell->value.compare_exchange_strong(expected, ValueTraitsType::defaultValue())) {
+        --fromTable->m_heldKeys;
+        return true;
+      }
+      m_stats.onCasFailure();
+
+      auto migrated = v;
+      if (expected == ValueTraitsType::defaultValue()) {
+        if (toCell->value.compare_exchange_strong(migrated, ValueTraitsType::defaultValue())) {
+          --toTable->m_heldKeys;
+        }
+        return true;
+      }
+
+      // a write that came after ours in toTable is newer still
+      if (!toCell->value.compare_exchange_strong(migrated, expected)) {
+        return true;
+      }
+      v = expected;
+    }
+  }
+
+  enum class ModifyResult {
+    written, declined, vanished
+  };
+
+  // f(current, desired) decides whether to write and what. Returns whether it wrote,
+  // previous gets the value f saw and next the one stored.
+  // The value is modified where it lives. That is the active table, unless its
+  // newest copy is in an old table: a settled one has it moved over first. An old
+  // table still in its grace period is modified in place by operations that were
+  // pinned before the grace period began, the migration waits for them anyway.
+  // Later ones wait for the grace period to end, so no write is ever stranded in a
+  // table whose cells are being moved. That wait blocks: it lasts as long as the
+  // slowest operation pinned before the table was retired, and backs off, yielding,
+  // between looks.
+  // A key that is in no table yet is created the same way. Operations pinned before
+  // a table was retired may still create it there, so later ones wait until the
+  // old tables settled, and the earlier ones create it in the oldest unsettled
+  // table. Otherwise two writers could each create the key in a table of their own,
+  // and the migration would keep only the newer table's write.
+  template <typename F>
+  bool modify(KeyType k, F f, ValueType& previous, ValueType& next) {
+    typename ReclamationType::guard guard;
+    helpMigrate();
+
+    previous = next = ValueTraitsType::defaultValue();
+    auto hash = KeyTraitsType::hash(k);
+    auto yields = 1;
+    for (;;) {
+      auto moves = m_movedValues.load(std::memory_order::memory_order_acquire);
+      TableType* table = m_activeTable.load();
+      auto cell = table->findFirstCellFor(k, hash);
+      auto claimed = false;
+
+      if (cell == nullptr || cell->value.load(std::memory_order::memory_order_acquire) == ValueTraitsType::defaultValue()) {
+        TableType* oldTable = nullptr;
+        auto oldCell = m_oldTables.findNewestCellFor(k, hash, &oldTable);
+
+        if (oldCell != nullptr) {
+          if (mayMigrate(oldTable)) {
+            migrateCell(oldTable, oldCell, table);
+            continue;
+          }
+          if (!migrationPaused() && GracePeriod::pinnedAt(guard) > oldTable->m_retiredAt.load()) {
+            backOff(yields);
+            continue;
+          }
+
+          auto result = modifyCell(oldCell, f, previous, next, false);
+          if (result == ModifyResult::vanished) continue;
+
+          if (result == ModifyResult::written && next == ValueTraitsType::defaultValue()) {
+            --oldTable->m_heldKeys;
+            m_oldTables.removeValueHistorically(k);
+          }
+          return result == ModifyResult::written;
+        }
+
+        // a new key is created in the oldest table that may still take writes, so
+        // every writer creates it in the same table, whichever one it took for active
+        // the key may have moved past the lookups
+        if (movedSince(moves)) {
+          continue;
+        }
+
+        bool wait;
+        auto unsettled = oldestUnsettled(guard, wait);
+        if (wait) {
+          backOff(yields);
+          continue;
+        }
+        if (unsettled != nullptr) {
+          auto unsettledCell = unsettled->fillFirstCellFor(k, hash, claimed);
+          if (unsettledCell != nullptr) {
+            table = unsettled;
+            cell = unsettledCell;
+          }
+        }
+      }
+
+      if (cell == nullptr) {
+        cell = table->fillFirstCellFor(k, hash, claimed);
+        if (cell == nullptr) {
+          onOverflow(table);
+          continue;
+        }
+      }
+
+      auto written = modifyCell(cell, f, previous, next, true) == ModifyResult::written;
+      auto keyInserted = written && previous == ValueTraitsType::defaultValue() && next != ValueTraitsType::defaultValue();
+      onInserted(table, keyInserted, claimed);
+      if (!written) {
+        return false;
+      }
+
+      if (!keyInserted && previous != ValueTraitsType::defaultValue() && next == ValueTraitsType::defaultValue()) {
+        --table->m_heldKeys;
+        m_oldTables.removeValueHistorically(k);
+      }
+      return true;
+    }
+  }
+
+  // The oldest old table still in its grace period, nullptr if all are settled.
+  // wait tells whether one of them was retired before the guard was pinned.
+  TableType* oldestUnsettled(const typename ReclamationType::guard& guard, bool& wait) {
+    TableType* oldest = nullptr;
+    wait = false;
+    for (auto t = m_oldTables.m_newest.load(); t != nullptr; t = t->m_olderTable.load()) {
+      if (isDrained(t) || isSettled(t)) continue;
+
+      oldest = t;
+      if (!migrationPaused() && GracePeriod::pinnedAt(guard) > t->m_retiredAt.load()) {
+        wait = true;
+      }
+    }
+    return oldest;
+  }
+
+  // The CAS loop of modify. A cell of an old table may lose its value meanwhile, a
+  // missing value is only read from cells of the active table.
+  template <typename F>
+  ModifyResult modifyCell(CellType cell, F& f, ValueType& previous, ValueType& next, bool mayBeMissing) {
+    auto current = cell->value.load(std::memory_order::memory_order_acquire);
+    for (;;) {
+      if (!mayBeMissing && current == ValueTraitsType::defaultValue()) {
+        return ModifyResult::vanished;
+      }
+
+      previous = current;
+      if (!f(current, next)) {
+        return ModifyResult::declined;
+      }
+      if (next == current || cell->value.compare_exchange_strong(current, next)) {
+        return ModifyResult::written;
+      }
+    }
+  }
+
+  // migrates the next n cells of fromTable, returns true once the table is drained
+  bool migrateFirstElements(TableType* fromTable, TableType* toTable, int n) {
+    auto begin = fromTable->m_migratedCells.load(std::memory_order::memory_order_relaxed);
+    auto end = std::min(begin + n, fromTable->m_size);
+
+    for (auto i = begin; i < end; ++i) {
+      if (!migrateCell(fromTable, fromTable->cellAt(i), toTable)) {
+        fromTable->m_migratedCells.store(i, std::memory_order::memory_order_release);
+        return false;
+      }
+    }
+
+    fromTable->m_migratedCells.store(end, std::memory_order::memory_order_release);
+    return end == fromTable->m_size;
   }
 
 };
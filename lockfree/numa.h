@@ -0,0 +1,254 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "allocation.h"
+#include "lockfree.h"
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define LOCKFREE_NUMA
+#endif
+
+// The NUMA nodes as the kernel reports them. Without NUMA support there is one
+// node, node 0, and every page sits on it.
+struct numa_topology {
+  // node ids go from 0 to nodes() - 1, the highest id online sets the count
+  static int nodes() {
+    static const int count = countNodes();
+    return count;
+  }
+
+  // the node of the cpu the calling thread runs on right now
+  static int currentNode() {
+#ifdef LOCKFREE_NUMA
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) return static_cast<int>(node);
+#endif
+    return 0;
+  }
+
+  // the node of the page that holds p, -1 if the page isn't backed yet
+  static int nodeOf(const void* p) {
+#ifdef LOCKFREE_NUMA
+    void* page = const_cast<void*>(p);
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1, &page, nullptr, &status, 0) != 0 || status < 0) return -1;
+    return status;
+#else
+    return p != nullptr ? 0 : -1;
+#endif
+  }
+
+private:
+  // e.g. "0-1,3", the list in /sys/devices/system/node/online
+  static int countNodes() {
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string list;
+    if (!(online >> list)) return 1;
+
+    auto highest = 0, n = 0;
+    for (auto c : list) {
+      if (c >= '0' && c <= '9') {
+        n = n * 10 + (c - '0');
+        highest = std::max(highest, n);
+      } else {
+        n = 0;
+      }
+    }
+    return highest + 1;
+  }
+};
+
+// Names the node that numa_allocation memory of the calling thread goes to, for as
+// long as it lives. Scopes nest, the outer one is back once the inner one is gone.
+class NumaPlacement {
+public:
+  explicit NumaPlacement(int node): m_outer(current()) { current() = node; }
+  ~NumaPlacement() { current() = m_outer; }
+
+  NumaPlacement(const NumaPlacement&) = delete;
+  NumaPlacement& operator=(const NumaPlacement&) = delete;
+
+  // -1 outside of any scope
+  static int node() { return current(); }
+
+private:
+  static int& current() {
+    static thread_local int node = -1;
+    return node;
+  }
+
+  int m_outer;
+};
+
+#if defined(LOCKFREE_NUMA)
+
+// mmap_allocation with a memory policy on the mapping. Pages are bound to the node
+// of the allocating thread's NumaPlacement, or interleaved over every node without
+// one, so a table no longer sits on whichever node the thread that grew it ran on
+// and half of the threads don't pay for remote memory on every probe. The policy
+// is set before a page is first touched, the kernel places pages as they fault in.
+// A kernel that refuses the policy, e.g. in a container, leaves first touch.
+struct numa_allocation {
+  enum { ZeroFilled = mmap_allocation::ZeroFilled };
+
+  static void* allocate(size_t bytes) {
+    auto p = mmap_allocation::allocate(bytes);
+    place(p, bytes);
+    return p;
+  }
+
+  static void release(void* p, size_t bytes) {
+    mmap_allocation::release(p, bytes);
+  }
+
+private:
+  // nodes past the first 64 share the pages of the first 64
+  enum { MaskBits = 64 };
+
+  static void place(void* p, size_t bytes) {
+    uint64_t mask = 0;
+    auto node = NumaPlacement::node();
+    auto mode = MPOL_BIND;
+    if (node >= 0) {
+      mask = static_cast<uint64_t>(1) << (node % MaskBits);
+    } else {
+      mode = MPOL_INTERLEAVE;
+      for (int n = 0; n < std::min(numa_topology::nodes(), static_cast<int>(MaskBits)); ++n) {
+        mask |= static_cast<uint64_t>(1) << n;
+      }
+    }
+
+    // the kernel drops the last bit of maxnode, hence one more than the mask holds
+    syscall(SYS_mbind, p, bytes, mode, &mask, static_cast<unsigned long>(MaskBits + 1), 0);
+  }
+};
+
+#elif defined(__unix__) || defined(__APPLE__)
+
+// no memory policies to set, pages land where they are first touched
+using numa_allocation = mmap_allocation;
+
+#else
+
+using numa_allocation = heap_allocation;
+
+#endif
+
+// One LockFreeMap per NUMA node, each with its tables on its own node, for maps
+// that are read far more than they are written. Reads go to the replica of the
+// node the thread runs on and never leave the socket. Writes go to every replica,
+// under a lock striped by key, so all replicas apply the writes to a key in the
+// same order and end up the same. While a write is on its way, a reader on one
+// node may see it a moment before a reader on another.
+template <typename Tkey, typename Tvalue, typename Tkey_traits = key_traits<Tkey>, typename Tvalue_traits = value_traits<Tvalue>,
+          typename Treclamation = epoch_reclamation,
+          typename Ttable = Table<Tkey, Tvalue, Tkey_traits, Tvalue_traits, modulo_indexing, packed_layout, numa_allocation>>
+class ReplicatedLockFreeMap {
+public:
+  using KeyType = Tkey;
+  using ValueType = Tvalue;
+  using KeyTraitsType = Tkey_traits;
+  using ValueTraitsType = Tvalue_traits;
+  using ReplicaType = LockFreeMap<Tkey, Tvalue, Tkey_traits, Tvalue_traits, Treclamation, Ttable>;
+
+  // a replica per node unless replicas says otherwise, replica r lives on node r
+  // modulo the node count
+  explicit ReplicatedLockFreeMap(int initialSize = 1000, double maxLoadFactor = 0.5, double growthFactor = 4.0, int replicas = numa_topology::nodes()) {
+    if (replicas <= 0) throw std::invalid_argument("there has to be at least one replica");
+
+    for (auto r = 0; r < replicas; ++r) {
+      NumaPlacement placement(nodeOfReplica(r));
+      m_replicas.push_back(new ReplicaType(initialSize, maxLoadFactor, growthFactor));
+    }
+  }
+
+  ~ReplicatedLockFreeMap() {
+    for (auto replica : m_replicas) {
+      delete replica;
+    }
+  }
+
+  ReplicatedLockFreeMap(const ReplicatedLockFreeMap&) = delete;
+  ReplicatedLockFreeMap& operator=(const ReplicatedLockFreeMap&) = delete;
+
+  // a read may help migrate and grow its replica, a table it makes goes to the
+  // replica's node as well
+  ValueType get(KeyType k) {
+    auto r = localReplica();
+    NumaPlacement placement(nodeOfReplica(r));
+    return m_replicas[r]->get(k);
+  }
+
+  ValueType insert(KeyType k, ValueType v) {
+    std::lock_guard<std::mutex> lg(writeLockFor(k));
+    for (size_t r = 0; r < m_replicas.size(); ++r) {
+      NumaPlacement placement(nodeOfReplica(static_cast<int>(r)));
+      m_replicas[r]->insert(k, v);
+    }
+    return v;
+  }
+
+  // the value k had, as the replicas agree on it
+  ValueType remove(KeyType k) {
+    std::lock_guard<std::mutex> lg(writeLockFor(k));
+    auto removed = ValueTraitsType::defaultValue();
+    for (size_t r = 0; r < m_replicas.size(); ++r) {
+      NumaPlacement placement(nodeOfReplica(static_cast<int>(r)));
+      auto v = m_replicas[r]->remove(k);
+      if (r == 0) removed = v;
+    }
+    return removed;
+  }
+
+  int replicaCount() const {
+    return static_cast<int>(m_replicas.size());
+  }
+
+  ReplicaType& replica(int r) {
+    return *m_replicas[r];
+  }
+
+  // the replica the calling thread reads from
+  int localReplica() {
+    return cachedNode() % static_cast<int>(m_replicas.size());
+  }
+
+private:
+  enum { WriteStripes = 64, NodeRefreshReads = 1024 };
+
+  // asking the kernel on every read would cost more than a remote probe, threads
+  // move between nodes rarely
+  static int cachedNode() {
+    static thread_local int node = numa_topology::currentNode();
+    static thread_local int reads = 0;
+    if (++reads == NodeRefreshReads) {
+      reads = 0;
+      node = numa_topology::currentNode();
+    }
+    return node;
+  }
+
+  static int nodeOfReplica(int r) {
+    return r % numa_topology::nodes();
+  }
+
+  std::mutex& writeLockFor(KeyType k) {
+    return m_writeLocks[KeyTraitsType::hash(k) % WriteStripes];
+  }
+
+  std::vector<ReplicaType*> m_replicas;
+  std::mutex m_writeLocks[WriteStripes];
+};
+
+#endif // NUMA_H
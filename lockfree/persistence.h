@@ -0,0 +1,271 @@
+#ifndef PERSISTENCE_H
+#define PERSISTENCE_H
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "lockfree.h"
+
+// Tables on disk. A table file is a header page followed by the cells, byte for
+// byte as the table's layout keeps them in memory. Loading one maps the file
+// privately and hands the mapping to the table as its cells, so a warm start only
+// pages in what lookups touch and writes stay in memory. Files are only readable
+// by tables of the very same type: the header records the layout, the sizes of
+// keys and values and a fingerprint of the hash and indexing policies, and loading
+// refuses anything that doesn't match. Keys and values are written as they are,
+// so they must not point anywhere, e.g. string keys can't be saved.
+
+struct TableFileHeader {
+  // 2 folds the probing policy into the fingerprint of every file
+  enum { Version = 2 };
+  // the cells start on the page after the header
+  enum { Bytes = 4096 };
+
+  char magic[8];
+  uint32_t version;
+  uint32_t layoutId;
+  uint32_t keyBytes;
+  uint32_t valueBytes;
+  uint64_t capacity;
+  uint64_t cellBytes;
+  uint64_t heldKeys;
+  uint64_t freeCells;
+  uint64_t hashFingerprint;
+  uint64_t checksum;          // of the cells
+};
+
+template <typename MapType>
+class table_file {
+  using KeyType = typename MapType::KeyType;
+  using ValueType = typename MapType::ValueType;
+  using KeyTraitsType = typename MapType::KeyTraitsType;
+  using TableType = typename MapType::TableType;
+
+  static_assert(std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValueType>::value,
+                "only tables of trivially copyable keys and values can be saved");
+
+  static constexpr const char* Magic = "LFTABLE";
+  static const uint64_t FnvPrime = 0x100000001b3ull;
+  static const uint64_t FnvBasis = 0xcbf29ce484222325ull;
+
+  static std::runtime_error failure(const std::string& what, const std::string& path) {
+    return std::runtime_error(what + " " + path + (errno != 0 ? std::string(": ") + std::strerror(errno) : std::string()));
+  }
+
+  static void unmap(void* memory, size_t bytes) {
+    munmap(memory, bytes);
+  }
+
+public:
+  // FNV-1a over whole words, the tail byte by byte
+  static uint64_t checksum(const char* bytes, size_t n) {
+    auto h = FnvBasis;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+      uint64_t word;
+      std::memcpy(&word, bytes + i, sizeof(word));
+      h = (h ^ word) * FnvPrime;
+    }
+    for (; i < n; ++i) {
+      h = (h ^ static_cast<unsigned char>(bytes[i])) * FnvPrime;
+    }
+    return h;
+  }
+
+  // where a few fixed keys hash to, the capacity a size rounds up to and the probing policy
+  static uint64_t hashFingerprint() {
+    auto f = (FnvBasis ^ static_cast<uint64_t>(TableType::capacityFor(1000))) * FnvPrime;
+    f = (f ^ static_cast<uint64_t>(TableType::ProbingId)) * FnvPrime;
+    for (uint64_t i = 1; i <= 8; ++i) {
+      auto pattern = i * 0x9e3779b97f4a7c15ull;
+      KeyType k;
+      std::memset(&k, 0, sizeof(k));
+      std::memcpy(&k, &pattern, std::min(sizeof(k), sizeof(pattern)));
+      f = (f ^ KeyTraitsType::hash(k)) * FnvPrime;
+    }
+    return f;
+  }
+
+  // Writes what the map holds to path while writers carry on, as weakly consistent
+  // as forEach. One iteration counts the keys and then copies them, keys that come
+  // in between only take the free cells of the active table. The table is built in
+  // a file next to path that replaces it once complete, so a crash never leaves a
+  // torn file behind.
+  static void save(MapType& map, const std::string& path) {
+    auto loadFactor = map.maxLoadFactor();
+    auto iteration = map.iterate();
+
+    size_t keys = 0;
+    for (auto it = iteration.begin(); it != iteration.end(); ++it) ++keys;
+    keys += static_cast<size_t>(iteration.freeCells());
+
+    // racing inserts can still overrun the free cells a little, then it's retried bigger
+    for (;;) {
+      auto wanted = static_cast<double>(keys + keys / 16 + 16) / loadFactor + 1;
+      if (wanted > INT_MAX) throw std::length_error("map is too big for a table file");
+
+      auto capacity = TableType::capacityFor(static_cast<int>(wanted));
+      if (write(iteration, path, capacity, std::max(1, static_cast<int>(capacity * loadFactor)), keys)) return;
+    }
+  }
+
+  // The table saved in path, over a private mapping of the file. The header is always
+  // checked, the cells only with verify: it reads the whole file once to check them
+  // against the checksum, paging in every cell a warm start would otherwise skip.
+  static TableType* load(const std::string& path, bool verify = false) {
+    errno = 0;
+    auto fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) throw failure("cannot open", path);
+
+    struct stat st;
+    TableFileHeader header;
+    if (fstat(fd, &st) != 0 || pread(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+      auto error = failure("cannot read", path);
+      close(fd);
+      throw error;
+    }
+
+    errno = 0;
+    auto problem = validate(header, static_cast<uint64_t>(st.st_size));
+    if (problem != nullptr) {
+      close(fd);
+      throw failure(problem, path);
+    }
+
+    auto bytes = static_cast<size_t>(st.st_size);
+    auto memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (memory == MAP_FAILED) {
+      auto error = failure("cannot map", path);
+      close(fd);
+      throw error;
+    }
+    close(fd);
+
+    auto cells = static_cast<char*>(memory) + TableFileHeader::Bytes;
+    if (verify && checksum(cells, header.cellBytes) != header.checksum) {
+      munmap(memory, bytes);
+      errno = 0;
+      throw failure("checksum mismatch in", path);
+    }
+
+    PlacedCells placed{ cells, true, memory, bytes, &unmap };
+    try {
+      return new TableType(static_cast<int>(header.capacity), static_cast<int>(header.freeCells), static_cast<int>(header.heldKeys), placed);
+    } catch (...) {
+      munmap(memory, bytes);
+      throw;
+    }
+  }
+
+private:
+  static const char* validate(const TableFileHeader& header, uint64_t fileBytes) {
+    if (std::memcmp(header.magic, Magic, sizeof(header.magic)) != 0) return "not a table file:";
+    if (header.version != static_cast<uint32_t>(TableFileHeader::Version)) return "unsupported version of";
+    if (header.layoutId != static_cast<uint32_t>(TableType::LayoutId) || header.keyBytes != sizeof(KeyType) || header.valueBytes != sizeof(ValueType)) {
+      return "different cell layout in";
+    }
+    if (header.hashFingerprint != hashFingerprint()) return "different hash, indexing or probing policy in";
+    if (header.capacity == 0 || header.capacity > static_cast<uint64_t>(INT_MAX) || header.freeCells == 0 || header.freeCells > header.capacity ||
+        header.cellBytes != TableType::cellBytes(static_cast<int>(header.capacity))) {
+      return "inconsistent header in";
+    }
+    if (fileBytes != TableFileHeader::Bytes + header.cellBytes) return "wrong size of";
+    return nullptr;
+  }
+
+  // false if the keys didn't fit into capacity, keys then gets how many there were so far
+  static bool write(const typename MapType::Iteration& iteration, const std::string& path, int capacity, int allowedKeys, size_t& keys) {
+    auto temporary = path + ".tmp";
+    auto cellBytes = TableType::cellBytes(capacity);
+    auto bytes = TableFileHeader::Bytes + cellBytes;
+
+    errno = 0;
+    auto fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) throw failure("cannot create", temporary);
+
+    void* memory = MAP_FAILED;
+    if (ftruncate(fd, static_cast<off_t>(bytes)) == 0) {
+      memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (memory == MAP_FAILED) {
+      auto error = failure("cannot map", temporary);
+      close(fd);
+      unlink(temporary.c_str());
+      throw error;
+    }
+
+    auto cells = static_cast<char*>(memory) + TableFileHeader::Bytes;
+    int heldKeys = 0;
+    auto full = false;
+    {
+      PlacedCells placed{ cells, false, nullptr, 0, nullptr };
+      TableType table(capacity, allowedKeys, 0, placed);
+
+      for (auto it = iteration.begin(); it != iteration.end() && !full; ++it) {
+        ValueType previous;
+        if (++heldKeys >= allowedKeys || table.insertOrAssign(it->first, KeyTraitsType::hash(it->first), it->second, previous) == nullptr) {
+          full = true;
+        }
+      }
+    }
+
+    if (full) {
+      munmap(memory, bytes);
+      close(fd);
+      unlink(temporary.c_str());
+      keys = std::max(keys * 2, static_cast<size_t>(heldKeys) * 2);
+      return false;
+    }
+
+    TableFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, Magic, sizeof(header.magic));
+    header.version = TableFileHeader::Version;
+    header.layoutId = TableType::LayoutId;
+    header.keyBytes = sizeof(KeyType);
+    header.valueBytes = sizeof(ValueType);
+    header.capacity = static_cast<uint64_t>(capacity);
+    header.cellBytes = cellBytes;
+    header.heldKeys = static_cast<uint64_t>(heldKeys);
+    header.freeCells = static_cast<uint64_t>(allowedKeys - heldKeys);
+    header.hashFingerprint = hashFingerprint();
+    header.checksum = checksum(cells, cellBytes);
+    std::memcpy(memory, &header, sizeof(header));
+
+    errno = 0;
+    auto synced = msync(memory, bytes, MS_SYNC) == 0;
+    munmap(memory, bytes);
+    close(fd);
+    if (!synced || rename(temporary.c_str(), path.c_str()) != 0) {
+      auto error = failure("cannot write", path);
+      unlink(temporary.c_str());
+      throw error;
+    }
+    return true;
+  }
+};
+
+// Saves a snapshot of map to path, see table_file::save.
+template <typename MapType>
+void saveSnapshot(MapType& map, const std::string& path) {
+  table_file<MapType>::save(map, path);
+}
+
+// The table saved in path, for the map constructor that takes over a table:
+//   MapType m(loadTable<MapType>(path));
+template <typename MapType>
+typename MapType::TableType* loadTable(const std::string& path, bool verify = false) {
+  return table_file<MapType>::load(path, verify);
+}
+
+#endif // PERSISTENCE_H
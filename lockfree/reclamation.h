@@ -0,0 +1,246 @@
+#ifndef RECLAMATION_H
+#define RECLAMATION_H
+
+#include <atomic>
+#include <cstdint>
+
+// Reclamation policies decide when an object that was unlinked from a shared
+// structure can be deleted. A policy provides:
+//   guard         - RAII, pins the calling thread while it may hold shared pointers
+//   retire(p)     - p is unreachable for new readers, delete it once it is safe
+//   collect()     - frees whatever became safe, retire already calls it
+// Policies that track readers can also tell when a grace period is over:
+//   epoch()       - a token for now
+//   passed(token) - every guard that was pinned when the token was taken is gone
+//   guard.epoch() - the token the outermost guard of the thread was pinned with
+// See grace_period below for policies that don't.
+
+// Never frees anything, for callers that manage the memory themselves. Has no
+// epochs, see grace_period for what that means to concurrent writers.
+struct leaky_reclamation {
+  struct guard {
+    guard() {}
+  };
+
+  template <typename T>
+  static void retire(T*) {}
+
+  static void collect() {}
+};
+
+// Grace periods of a reclamation policy. Without epochs to go by, a grace period
+// is over right away, and every guard counts as pinned at the beginning of time.
+// LockFreeMap then moves the cells of a retired table while writers that still
+// take it for the active one may write to it, so such policies are only safe for
+// maps that are written by one thread at a time.
+template <typename ReclamationType>
+struct grace_period {
+  static uint64_t now() { return now<ReclamationType>(0); }
+  static bool passed(uint64_t token) { return passed<ReclamationType>(token, 0); }
+  static uint64_t pinnedAt(const typename ReclamationType::guard& g) { return pinnedAt<ReclamationType>(g, 0); }
+
+private:
+  template <typename R>
+  static auto now(int) -> decltype(R::epoch()) { return R::epoch(); }
+  template <typename R>
+  static uint64_t now(long) { return 0; }
+
+  template <typename R>
+  static auto passed(uint64_t token, int) -> decltype(R::passed(token)) { return R::passed(token); }
+  template <typename R>
+  static bool passed(uint64_t, long) { return true; }
+
+  template <typename R>
+  static auto pinnedAt(const typename R::guard& g, int) -> decltype(g.epoch()) { return g.epoch(); }
+  template <typename R>
+  static uint64_t pinnedAt(const typename R::guard&, long) { return 0; }
+};
+
+// Epoch based reclamation over a process wide domain. Readers announce the global
+// epoch they entered in, an object retired in epoch e is deleted once the global
+// epoch reached e + 2, since by then no pinned thread can still see it.
+class epoch_reclamation {
+  static const uint64_t ActiveBit = 1;
+  static const int CollectEvery = 128;
+
+  // padded rather than aligned, plain new only honours alignas from C++17 on
+  struct ThreadRecord {
+    char leadingPadding[64];
+    std::atomic<uint64_t> localEpoch;
+    std::atomic<bool> inUse;
+    ThreadRecord* next;
+    int nesting;
+    int leavesSinceCollect;
+    char trailingPadding[64];
+  };
+
+  struct Retired {
+    void* object;
+    void (*deleter)(void*);
+    uint64_t epoch;
+    Retired* next;
+  };
+
+  struct Domain {
+    std::atomic<uint64_t> epoch;
+    std::atomic<ThreadRecord*> records;
+    std::atomic<Retired*> retired;
+  };
+
+  static Domain& domain() {
+    static Domain d{ {0}, {nullptr}, {nullptr} };
+    return d;
+  }
+
+  // records are never freed, a thread leaving hands its record to the next one
+  static ThreadRecord* acquireRecord() {
+    auto& d = domain();
+    for (auto r = d.records.load(std::memory_order::memory_order_acquire); r != nullptr; r = r->next) {
+      auto inUse = false;
+      if (!r->inUse.load(std::memory_order::memory_order_relaxed) && r->inUse.compare_exchange_strong(inUse, true)) {
+        return r;
+      }
+    }
+
+    auto r = new ThreadRecord();
+    r->localEpoch.store(0, std::memory_order::memory_order_relaxed);
+    r->inUse.store(true, std::memory_order::memory_order_relaxed);
+    r->nesting = 0;
+    r->leavesSinceCollect = 0;
+
+    auto head = d.records.load(std::memory_order::memory_order_relaxed);
+    do {
+      r->next = head;
+    } while (!d.records.compare_exchange_weak(head, r));
+
+    return r;
+  }
+
+  struct RecordHolder {
+    RecordHolder(): m_record(acquireRecord()) {}
+    ~RecordHolder() {
+      m_record->localEpoch.store(0, std::memory_order::memory_order_release);
+      m_record->inUse.store(false, std::memory_order::memory_order_release);
+    }
+
+    ThreadRecord* m_record;
+  };
+
+  static ThreadRecord* localRecord() {
+    static thread_local RecordHolder holder;
+    return holder.m_record;
+  }
+
+  static bool tryAdvance(uint64_t epoch) {
+    auto& d = domain();
+    for (auto r = d.records.load(std::memory_order::memory_order_acquire); r != nullptr; r = r->next) {
+      auto local = r->localEpoch.load(std::memory_order::memory_order_seq_cst);
+      if ((local & ActiveBit) && (local >> 1) != epoch) {
+        return false;
+      }
+    }
+
+    return d.epoch.compare_exchange_strong(epoch, epoch + 1);
+  }
+
+  static void push(Retired* first, Retired* last) {
+    auto& d = domain();
+    auto head = d.retired.load(std::memory_order::memory_order_relaxed);
+    do {
+      last->next = head;
+    } while (!d.retired.compare_exchange_weak(head, first));
+  }
+
+  template <typename T>
+  static void deleteObject(void* p) {
+    delete static_cast<T*>(p);
+  }
+
+public:
+  class guard {
+  public:
+    guard(): m_record(localRecord()) {
+      if (m_record->nesting++ == 0) {
+        auto epoch = domain().epoch.load(std::memory_order::memory_order_relaxed);
+        m_record->localEpoch.store((epoch << 1) | ActiveBit, std::memory_order::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order::memory_order_seq_cst);
+      }
+    }
+
+    ~guard() {
+      if (--m_record->nesting == 0) {
+        m_record->localEpoch.store(0, std::memory_order::memory_order_release);
+
+        if (++m_record->leavesSinceCollect == CollectEvery) {
+          m_record->leavesSinceCollect = 0;
+          if (domain().retired.load(std::memory_order::memory_order_relaxed) != nullptr) {
+            collect();
+          }
+        }
+      }
+    }
+
+    guard(const guard&) = delete;
+    guard& operator=(const guard&) = delete;
+
+    uint64_t epoch() const {
+      return m_record->localEpoch.load(std::memory_order::memory_order_relaxed) >> 1;
+    }
+
+  private:
+    ThreadRecord* m_record;
+  };
+
+  template <typename T>
+  static void retire(T* p) {
+    if (p == nullptr) return;
+
+    auto r = new Retired{ p, &deleteObject<T>, domain().epoch.load(std::memory_order::memory_order_seq_cst), nullptr };
+    push(r, r);
+    collect();
+  }
+
+  static uint64_t epoch() {
+    return domain().epoch.load(std::memory_order::memory_order_seq_cst);
+  }
+
+  // a guard pinned in epoch e keeps the epoch from going past e + 1
+  static bool passed(uint64_t token) {
+    auto epoch = domain().epoch.load(std::memory_order::memory_order_seq_cst);
+    if (epoch >= token + 2) return true;
+
+    return tryAdvance(epoch) && epoch + 1 >= token + 2;
+  }
+
+  static void collect() {
+    auto& d = domain();
+    auto epoch = d.epoch.load(std::memory_order::memory_order_seq_cst);
+    if (tryAdvance(epoch)) {
+      ++epoch;
+    }
+
+    // take the whole list so no other collector frees the same nodes
+    auto r = d.retired.exchange(nullptr, std::memory_order::memory_order_acquire);
+    Retired* keepFirst = nullptr;
+    Retired* keepLast = nullptr;
+
+    while (r != nullptr) {
+      auto next = r->next;
+      if (r->epoch + 2 <= epoch) {
+        r->deleter(r->object);
+        delete r;
+      } else {
+        r->next = keepFirst;
+        keepFirst = r;
+        if (keepLast == nullptr) keepLast = r;
+      }
+      r = next;
+    }
+
+    if (keepFirst != nullptr) {
+      push(keepFirst, keepLast);
+    }
+  }
+};
+
+#endif // RECLAMATION_H
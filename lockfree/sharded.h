@@ -0,0 +1,88 @@
+#ifndef SHARDED_H
+#define SHARDED_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include "lockfree.h"
+
+// Front-end over Nshards independent LockFreeMaps. A remix of a key's hash picks
+// its shard, so every shard has its own tables, counters and resizes, and
+// writers on different shards never touch the same cache lines. The tables index
+// with the whole hash, keys of one shard still spread over all of its cells and
+// still differ in the high bits TaggedTable keeps as tags.
+template <typename Tkey, typename Tvalue, int Nshards = 16, typename Tkey_traits = key_traits<Tkey>, typename Tvalue_traits = value_traits<Tvalue>,
+          typename Treclamation = epoch_reclamation, typename Ttable = Table<Tkey, Tvalue, Tkey_traits, Tvalue_traits>>
+class ShardedLockFreeMap {
+  static_assert(Nshards > 0, "there has to be at least one shard");
+
+public:
+  using KeyType = Tkey;
+  using ValueType = Tvalue;
+  using KeyTraitsType = Tkey_traits;
+  using ShardType = LockFreeMap<Tkey, Tvalue, Tkey_traits, Tvalue_traits, Treclamation, Ttable>;
+
+  static const int ShardCount = Nshards;
+
+  ShardedLockFreeMap(): ShardedLockFreeMap(1000) {}
+
+  // initialSize is for the whole map, every shard starts with its share of it
+  ShardedLockFreeMap(int initialSize, double maxLoadFactor = 0.5, double growthFactor = 4.0) {
+    auto shardSize = std::max(1, initialSize / Nshards);
+    for (auto i = 0; i < Nshards; ++i) {
+      m_shards[i] = new ShardType(shardSize, maxLoadFactor, growthFactor);
+    }
+  }
+
+  ~ShardedLockFreeMap() {
+    for (auto i = 0; i < Nshards; ++i) {
+      delete m_shards[i];
+    }
+  }
+
+  ShardedLockFreeMap(const ShardedLockFreeMap&) = delete;
+  ShardedLockFreeMap& operator=(const ShardedLockFreeMap&) = delete;
+
+  ValueType insert(KeyType k, ValueType v) {
+    return shardFor(k).insert(k, v);
+  }
+
+  ValueType get(KeyType k) {
+    return shardFor(k).get(k);
+  }
+
+  ValueType remove(KeyType k) {
+    return shardFor(k).remove(k);
+  }
+
+  // the shards' statistics summed up
+  MapStatsSnapshot stats() const {
+    auto result = MapStatsSnapshot();
+    for (auto i = 0; i < Nshards; ++i) {
+      result += m_shards[i]->stats();
+    }
+    return result;
+  }
+
+  ShardType& shard(int i) {
+    return *m_shards[i];
+  }
+
+  // The hash is remixed by a multiplier of its own, whose high bits depend on every
+  // bit of the hash, then multiply-high range reduction works for any shard count.
+  // Taking the hash's own high bits would leave a shard's keys fewer distinct tags.
+  static int shardIndexFor(KeyType k) {
+    auto mixed = (static_cast<uint64_t>(KeyTraitsType::hash(k)) * 0xff51afd7ed558ccdull) >> 32;
+    return static_cast<int>((mixed * Nshards) >> 32);
+  }
+
+private:
+  ShardType& shardFor(KeyType k) {
+    return *m_shards[shardIndexFor(k)];
+  }
+
+  // only read after construction, the shards' own hot fields sit in their own allocations
+  ShardType* m_shards[Nshards];
+};
+
+#endif // SHARDED_H
@@ -0,0 +1,217 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef LOCKFREE_ENABLE_STATS
+#include <chrono>
+#endif
+
+// Operation statistics of a map. They are only gathered when LOCKFREE_ENABLE_STATS
+// is defined, for the whole program at once (the CMake option of the same name), as
+// the map's layout depends on it. Without it every hook below is an empty inline
+// function and a snapshot reads all zeros.
+
+// What a map went through so far. Counters of concurrent operations are summed
+// without a common point in time, so a snapshot is only consistent once the map is
+// quiet.
+struct MapStatsSnapshot {
+  // probe lengths are bucketed by powers of 2: 1, 2-3, 4-7, ..., the last bucket
+  // takes everything longer
+  enum { ProbeBuckets = 12 };
+
+  uint64_t inserts;
+  uint64_t gets;
+  uint64_t removes;
+  uint64_t failedInsertions;   // a table had no cell left for a key and grew early
+  uint64_t oldTableLookups;    // gets that missed the active table and searched old tables
+  uint64_t casFailures;        // lost races on a cell's key or on a migrated value
+  uint64_t resizes;
+  uint64_t compactions;        // resizes into a table of the same size, to drop tombstones
+  uint64_t resizeNanos;        // spent allocating and clearing the new tables
+  uint64_t probeLengths[ProbeBuckets];
+
+  MapStatsSnapshot& operator+=(const MapStatsSnapshot& other) {
+    inserts += other.inserts;
+    gets += other.gets;
+    removes += other.removes;
+    failedInsertions += other.failedInsertions;
+    oldTableLookups += other.oldTableLookups;
+    casFailures += other.casFailures;
+    resizes += other.resizes;
+    compactions += other.compactions;
+    resizeNanos += other.resizeNanos;
+    for (int i = 0; i < ProbeBuckets; ++i) {
+      probeLengths[i] += other.probeLengths[i];
+    }
+    return *this;
+  }
+
+  static int bucketOf(int probes) {
+    auto bucket = probes <= 1 ? 0 : 31 - __builtin_clz(static_cast<uint32_t>(probes));
+    return bucket < ProbeBuckets ? bucket : ProbeBuckets - 1;
+  }
+};
+
+// Tables report how long their last probe was, and every CAS they lost, to the
+// calling thread. The map picks that up right after the call, so tables don't need
+// to know which map, if any, they belong to.
+struct probe_stats {
+#ifdef LOCKFREE_ENABLE_STATS
+  struct Scratch {
+    int lastProbe;
+    int casFailures;
+  };
+
+  static Scratch& scratch() {
+    static thread_local Scratch s{ 0, 0 };
+    return s;
+  }
+
+  static void record(int probes) { scratch().lastProbe = probes; }
+  static void casFailed() { ++scratch().casFailures; }
+#else
+  static void record(int) {}
+  static void casFailed() {}
+#endif
+};
+
+// Ncounters counters striped over cache line padded slots, a thread always counts
+// into the same slot. Threads only share a slot once there are more of them than
+// stripes, so the increments are relaxed atomics that rarely contend. Available
+// with statistics off as well, LockFreeCache always counts.
+template <int Ncounters>
+class striped_counters {
+  enum { Stripes = 16 };
+
+  struct Stripe {
+    char leadingPadding[64];
+    std::atomic<uint64_t> counters[Ncounters];
+    char trailingPadding[64];
+  };
+
+  static int stripeIndex() {
+    static std::atomic<int> nextThread(0);
+    static thread_local int index = nextThread++ % Stripes;
+    return index;
+  }
+
+public:
+  striped_counters() {
+    for (auto& s : m_stripes) {
+      for (auto& c : s.counters) c.store(0, std::memory_order::memory_order_relaxed);
+    }
+  }
+
+  void add(int counter, uint64_t n = 1) {
+    m_stripes[stripeIndex()].counters[counter].fetch_add(n, std::memory_order::memory_order_relaxed);
+  }
+
+  uint64_t sum(int counter) const {
+    uint64_t result = 0;
+    for (auto& s : m_stripes) {
+      result += s.counters[counter].load(std::memory_order::memory_order_relaxed);
+    }
+    return result;
+  }
+
+private:
+  Stripe m_stripes[Stripes];
+};
+
+#ifdef LOCKFREE_ENABLE_STATS
+
+// The counters of operations are striped, see striped_counters.
+class map_stats {
+  enum Counter {
+    Inserts, Gets, Removes, FailedInsertions, OldTableLookups, CasFailures, ProbeLengths,
+    Counters = ProbeLengths + MapStatsSnapshot::ProbeBuckets
+  };
+
+  static void add(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.fetch_add(n, std::memory_order::memory_order_relaxed);
+  }
+
+public:
+  static const bool Enabled = true;
+
+  map_stats(): m_resizes(0), m_compactions(0), m_resizeNanos(0) {}
+
+  static uint64_t now() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
+
+  void onInsert() { m_counters.add(Inserts); }
+  void onGet() { m_counters.add(Gets); }
+  void onRemove() { m_counters.add(Removes); }
+  void onFailedInsertion() { m_counters.add(FailedInsertions); }
+  void onOldTableLookup() { m_counters.add(OldTableLookups); }
+  void onCasFailure() { m_counters.add(CasFailures); }
+
+  // takes over what the last table probe of this thread reported
+  void onProbe() {
+    auto& s = probe_stats::scratch();
+    m_counters.add(ProbeLengths + MapStatsSnapshot::bucketOf(s.lastProbe));
+    if (s.casFailures != 0) {
+      m_counters.add(CasFailures, static_cast<uint64_t>(s.casFailures));
+      s.casFailures = 0;
+    }
+  }
+
+  // resizes are rare, they go to shared counters
+  void onResize(uint64_t nanos) {
+    add(m_resizes);
+    add(m_resizeNanos, nanos);
+  }
+
+  void onCompaction() { add(m_compactions); }
+
+  MapStatsSnapshot snapshot() const {
+    MapStatsSnapshot result = MapStatsSnapshot();
+    result.inserts = m_counters.sum(Inserts);
+    result.gets = m_counters.sum(Gets);
+    result.removes = m_counters.sum(Removes);
+    result.failedInsertions = m_counters.sum(FailedInsertions);
+    result.oldTableLookups = m_counters.sum(OldTableLookups);
+    result.casFailures = m_counters.sum(CasFailures);
+    for (int i = 0; i < MapStatsSnapshot::ProbeBuckets; ++i) {
+      result.probeLengths[i] = m_counters.sum(ProbeLengths + i);
+    }
+    result.resizes = m_resizes.load(std::memory_order::memory_order_relaxed);
+    result.compactions = m_compactions.load(std::memory_order::memory_order_relaxed);
+    result.resizeNanos = m_resizeNanos.load(std::memory_order::memory_order_relaxed);
+    return result;
+  }
+
+private:
+  striped_counters<Counters> m_counters;
+  std::atomic<uint64_t> m_resizes;
+  std::atomic<uint64_t> m_compactions;
+  std::atomic<uint64_t> m_resizeNanos;
+};
+
+#else
+
+class map_stats {
+public:
+  static const bool Enabled = false;
+
+  static uint64_t now() { return 0; }
+
+  void onInsert() {}
+  void onGet() {}
+  void onRemove() {}
+  void onFailedInsertion() {}
+  void onOldTableLookup() {}
+  void onCasFailure() {}
+  void onProbe() {}
+  void onResize(uint64_t) {}
+  void onCompaction() {}
+
+  MapStatsSnapshot snapshot() const { return MapStatsSnapshot(); }
+};
+
+#endif
+
+#endif // STATS_H
@@ -0,0 +1,179 @@
+#ifndef STRING_KEYS_H
+#define STRING_KEYS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+
+#include "lockfree.h"
+
+// A string stored in a StringArena, with its hash computed once.
+struct ArenaString {
+  uint32_t hash;
+  uint32_t length;
+  const char* bytes;
+
+  static uint32_t hashOf(const char* bytes, size_t length) {
+    // FNV-1a, then murmur's finalizer so the high bits are as good as the low ones
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+      h ^= static_cast<unsigned char>(bytes[i]);
+      h *= 16777619u;
+    }
+    return murmur_hash::hash(h);
+  }
+};
+
+// Lock-free append-only storage for the bytes of string keys. Allocation bumps an
+// offset in the current chunk, a thread that finds the chunk full installs a new
+// one. Nothing is freed before the arena itself, keys live as long as their map.
+class StringArena {
+  enum { ChunkSize = 64 * 1024 };
+
+  struct Chunk {
+    Chunk(size_t size, Chunk* previous): m_previous(previous), m_size(size), m_used(0), m_data(new char[size]) {}
+    ~Chunk() { delete[] m_data; }
+
+    Chunk* m_previous;
+    size_t m_size;
+    std::atomic<size_t> m_used;
+    char* m_data;
+  };
+
+  // 8 byte aligned, entries start with an ArenaString
+  char* allocate(size_t n) {
+    n = (n + 7) & ~static_cast<size_t>(7);
+
+    for (;;) {
+      auto chunk = m_current.load(std::memory_order::memory_order_acquire);
+      auto offset = chunk->m_used.fetch_add(n, std::memory_order::memory_order_relaxed);
+      if (offset + n <= chunk->m_size) {
+        return chunk->m_data + offset;
+      }
+
+      auto next = new Chunk(std::max(static_cast<size_t>(ChunkSize), n), chunk);
+      if (!m_current.compare_exchange_strong(chunk, next)) {
+        delete next;
+      }
+    }
+  }
+
+public:
+  StringArena(): m_current(new Chunk(static_cast<size_t>(ChunkSize), nullptr)) {}
+
+  ~StringArena() {
+    for (auto chunk = m_current.load(); chunk != nullptr; ) {
+      auto previous = chunk->m_previous;
+      delete chunk;
+      chunk = previous;
+    }
+  }
+
+  StringArena(const StringArena&) = delete;
+  StringArena& operator=(const StringArena&) = delete;
+
+  const ArenaString* add(const char* bytes, size_t length, uint32_t hash) {
+    auto memory = allocate(sizeof(ArenaString) + length);
+    auto copy = memory + sizeof(ArenaString);
+    std::memcpy(copy, bytes, length);
+    return new (memory) ArenaString{ hash, static_cast<uint32_t>(length), copy };
+  }
+
+private:
+  std::atomic<Chunk*> m_current;
+};
+
+// String keys as a single word: the ArenaString's address in the low 48 bits, the
+// top 16 bits of its hash above them. Most keys that aren't equal differ in those
+// 16 bits, so they are told apart without following the pointer. 0 is no key.
+// Following it relies on tables loading keys with acquire, see key_equality.
+struct string_key_traits {
+  static uint64_t defaultValue() { return 0; }
+
+  static uint64_t wordFor(const ArenaString* s) {
+    return reinterpret_cast<uintptr_t>(s) | (static_cast<uint64_t>(s->hash >> 16) << 48);
+  }
+
+  static const ArenaString* stringOf(uint64_t word) {
+    return reinterpret_cast<const ArenaString*>(static_cast<uintptr_t>(word & ((static_cast<uint64_t>(1) << 48) - 1)));
+  }
+
+  static uint32_t hash(uint64_t word) {
+    return stringOf(word)->hash;
+  }
+
+  static bool equal(uint64_t a, uint64_t b) {
+    if (a == b) return true;
+    if ((a >> 48) != (b >> 48) || a == 0 || b == 0) return false;
+
+    auto sa = stringOf(a);
+    auto sb = stringOf(b);
+    return sa->hash == sb->hash && sa->length == sb->length && std::memcmp(sa->bytes, sb->bytes, sa->length) == 0;
+  }
+};
+
+// LockFreeMap keyed by strings. The map holds string_key_traits words, the bytes go
+// to the map's arena the first time a key is inserted. Lookups and removals probe
+// with a word over an ArenaString on the stack, so they never allocate, and neither
+// does an insert of a key the map already holds.
+// Pointers need to fit in 48 bits, as they do on x86-64 and AArch64 user space.
+template <typename Tvalue, typename Tvalue_traits = value_traits<Tvalue>, typename Treclamation = epoch_reclamation,
+          typename Ttable = Table<uint64_t, Tvalue, string_key_traits, Tvalue_traits>>
+class StringLockFreeMap {
+  static_assert(sizeof(void*) <= sizeof(uint64_t), "pointers have to fit in a key word");
+
+public:
+  using ValueType = Tvalue;
+  using MapType = LockFreeMap<uint64_t, Tvalue, string_key_traits, Tvalue_traits, Treclamation, Ttable>;
+
+  StringLockFreeMap(): m_map() {}
+  StringLockFreeMap(int initialSize, double maxLoadFactor = 0.5, double growthFactor = 4.0): m_map(initialSize, maxLoadFactor, growthFactor) {}
+
+  ValueType insert(const char* bytes, size_t length, ValueType v) {
+    ArenaString probe{ ArenaString::hashOf(bytes, length), static_cast<uint32_t>(length), bytes };
+
+    auto word = m_map.storedKey(string_key_traits::wordFor(&probe));
+    if (word == string_key_traits::defaultValue()) {
+      word = string_key_traits::wordFor(m_arena.add(bytes, length, probe.hash));
+    }
+    return m_map.insert(word, v);
+  }
+
+  ValueType get(const char* bytes, size_t length) {
+    ArenaString probe{ ArenaString::hashOf(bytes, length), static_cast<uint32_t>(length), bytes };
+    return m_map.get(string_key_traits::wordFor(&probe));
+  }
+
+  ValueType remove(const char* bytes, size_t length) {
+    ArenaString probe{ ArenaString::hashOf(bytes, length), static_cast<uint32_t>(length), bytes };
+    return m_map.remove(string_key_traits::wordFor(&probe));
+  }
+
+  ValueType insert(const std::string& k, ValueType v) { return insert(k.data(), k.size(), v); }
+  ValueType get(const std::string& k) { return get(k.data(), k.size()); }
+  ValueType remove(const std::string& k) { return remove(k.data(), k.size()); }
+
+  ValueType insert(const char* k, ValueType v) { return insert(k, std::strlen(k), v); }
+  ValueType get(const char* k) { return get(k, std::strlen(k)); }
+  ValueType remove(const char* k) { return remove(k, std::strlen(k)); }
+
+#if __cplusplus >= 201703L
+  ValueType insert(std::string_view k, ValueType v) { return insert(k.data(), k.size(), v); }
+  ValueType get(std::string_view k) { return get(k.data(), k.size()); }
+  ValueType remove(std::string_view k) { return remove(k.data(), k.size()); }
+#endif
+
+private:
+  // declared first, the map's tables point into it
+  StringArena m_arena;
+  MapType m_map;
+};
+
+#endif // STRING_KEYS_H
@@ -1,15 +1,28 @@
 #ifndef TABLE_H
 #define TABLE_H
 
+#include <algorithm>
 #include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <limits>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
 
-template <typename T>
-struct key_traits {
-  static T defaultValue() { return T(); }
-  static uint32_t hash (T n) {
-    static_assert(std::is_integral<T>::value, "Key should be integer or a custom key_traits should be used.");
+#include "allocation.h"
+#include "filter.h"
+#include "stats.h"
+
+// hash policies for integer keys
+
+// murmur3's 32 bit finalizer, on the unsigned type so the shifts do not smear
+// the sign bit, which would leave the top bit of every hash clear
+struct murmur_hash {
+  template <typename T>
+  static uint32_t hash (T key) {
+    auto n = static_cast<typename std::make_unsigned<T>::type>(key);
     n ^= n >> 16;
     n *= 0x85ebca6b;
     n ^= n >> 13;
@@ -19,6 +32,49 @@ struct key_traits {
   }
 };
 
+// for keys that are already well spread, e.g. ids handed out at random
+struct identity_hash {
+  template <typename T>
+  static uint32_t hash (T n) {
+    return static_cast<uint32_t>(n);
+  }
+};
+
+// Fibonacci hashing, one multiplication, the high bits carry the entropy
+struct multiply_shift_hash {
+  template <typename T>
+  static uint32_t hash (T n) {
+    return static_cast<uint32_t>((static_cast<uint64_t>(n) * 0x9e3779b97f4a7c15ull) >> 32);
+  }
+};
+
+template <typename T, typename THashPolicy = murmur_hash>
+struct key_traits {
+  static T defaultValue() { return T(); }
+  static uint32_t hash (T n) {
+    static_assert(std::is_integral<T>::value, "Key should be integer or a custom key_traits should be used.");
+    return THashPolicy::hash(n);
+  }
+};
+
+// Keys are the same key when their traits say so. Traits of keys that refer to
+// their contents, e.g. interned strings, define equal(a, b); everything else is
+// compared with ==. Tables only call it on keys that are not the default value.
+// Keys are loaded with acquire and claimed with a seq_cst CAS, so the contents a
+// pointer-like key refers to, written before it was claimed, are there to read.
+template <typename KeyTraitsType>
+struct key_equality {
+  template <typename T>
+  static bool equal(T a, T b) { return equal<KeyTraitsType>(a, b, 0); }
+
+private:
+  template <typename Traits, typename T>
+  static auto equal(T a, T b, int) -> decltype(Traits::equal(a, b)) { return Traits::equal(a, b); }
+
+  template <typename Traits, typename T>
+  static bool equal(T a, T b, long) { return a == b; }
+};
+
 template <typename T>
 struct value_traits {
   static T defaultValue() { return T(); }
@@ -30,59 +86,612 @@ struct Element {
   std::atomic<ValueType> value;
 };
 
-template <typename KeyType, typename ValueType, typename KeyTraitsType = key_traits<KeyType>, typename ValueTraitsType = value_traits<ValueType>>
-class Table {
+// Indexing policies map a hash onto a cell and step to the next one.
+// modulo_indexing takes any size and divides once per probe sequence,
+// pow2_indexing rounds sizes up to a power of 2 and only masks.
+struct modulo_indexing {
+  static int capacityFor(int size) { return size; }
+  static uint32_t home(uint32_t hash, int size) { return hash % static_cast<uint32_t>(size); }
+  static uint32_t next(uint32_t idx, int size) { return ++idx == static_cast<uint32_t>(size) ? 0 : idx; }
+};
+
+struct pow2_indexing {
+  static int capacityFor(int size) {
+    if (size <= 0) return size;
+    if (size > (1 << 30)) throw std::invalid_argument("size is too big to be rounded up to a power of 2");
+
+    auto capacity = 1;
+    while (capacity < size) capacity <<= 1;
+    return capacity;
+  }
+  static uint32_t home(uint32_t hash, int size) { return hash & static_cast<uint32_t>(size - 1); }
+  static uint32_t next(uint32_t idx, int size) { return (idx + 1) & static_cast<uint32_t>(size - 1); }
+};
+
+// Probing policies pick the cells a key may sit in.
+//   first<Indexing>(hash, size)            - the cell a probe starts at
+//   next<Indexing>(idx, probe, hash, size) - the cell after idx, probe cells were visited
+//   limit(size)                            - cells a probe visits at most. A key that
+//                                            finds no cell within them doesn't fit, and
+//                                            the map grows the table.
+//   capacityFor(capacity)                  - the capacity the indexing policy picked,
+//                                            rounded up to what the policy needs
+// Keys never move once they are in a cell, so a lookup stops at the first cell
+// that was never used, whatever the sequence.
+
+// starts at the home cell the indexing policy picks, any capacity will do
+struct home_cell_probing {
+  template <typename IndexingType>
+  static uint32_t first(uint32_t hash, int size) { return IndexingType::home(hash, size); }
+  static int capacityFor(int capacity) { return capacity; }
+};
 
+struct linear_probing : home_cell_probing {
+  enum { Id = 1 };
+
+  template <typename IndexingType>
+  static uint32_t next(uint32_t idx, int, uint32_t, int size) { return IndexingType::next(idx, size); }
+  static int limit(int size) { return size; }
+};
+
+// Steps of 1, 2, 3, ... cells, the home cell plus triangular numbers. Keys that hash
+// next to each other part ways after a few probes instead of piling up into one
+// long run, and the sequence still visits every cell of a power of 2 table.
+struct triangular_probing : home_cell_probing {
+  enum { Id = 2 };
+
+  template <typename IndexingType>
+  static uint32_t next(uint32_t idx, int probe, uint32_t, int size) {
+    static_assert(std::is_same<IndexingType, pow2_indexing>::value, "triangular probing covers every cell only with pow2_indexing");
+    return IndexingType::home(idx + probe, size);
+  }
+  static int limit(int size) { return size; }
+};
+
+// Linear probing that never looks further than MaxProbes cells. A table fills up
+// when a key finds no cell within them, which caps the probe length of every
+// operation however high the load factor is set.
+template <int MaxProbes = 32>
+struct bounded_probing : home_cell_probing {
+  static_assert(MaxProbes > 0, "probes have to visit the home cell at least");
+
+  enum { Id = 0x100 + MaxProbes };
+
+  template <typename IndexingType>
+  static uint32_t next(uint32_t idx, int, uint32_t, int size) { return IndexingType::next(idx, size); }
+  static int limit(int size) { return std::min(size, static_cast<int>(MaxProbes)); }
+};
+
+// The bucket layout of cuckoo hashing: cells form buckets of Ways, and a key may
+// sit in two of them, one picked by the indexing policy and one by a second hash.
+// A probe never reads more than those two buckets, so a lookup costs two cache
+// lines at most, however full the table, once buckets are line aligned (Ways 8
+// and packed cells in mmap_allocation memory).
+// Keys are never kicked out to the other bucket as in cuckoo hashing, the map
+// hands out cells and relies on keys staying in them. The probe alternates
+// between the buckets instead, slot by slot, so a key lands in whichever bucket
+// is less full. Tables of random keys overflow from about a 0.73 load factor on
+// with 8 ways, 0.48 with 4, the map grows them then.
+template <int Ways = 8>
+struct two_choice_probing {
+  static_assert(Ways == 4 || Ways == 8, "buckets have 4 or 8 ways");
+
+  enum { Id = 0x200 + Ways };
+
+  template <typename IndexingType>
+  static uint32_t first(uint32_t hash, int size) {
+    return IndexingType::home(hash, size) / Ways * Ways;
+  }
+
+  // the odd probes go to the second bucket, the slot advances every other probe
+  template <typename IndexingType>
+  static uint32_t next(uint32_t, int probe, uint32_t hash, int size) {
+    auto bucket = first<IndexingType>(hash, size) / Ways;
+    if (probe % 2 == 1) bucket = secondBucket(hash, bucket, size / Ways);
+    return bucket * Ways + probe / 2;
+  }
+
+  static int limit(int) { return 2 * Ways; }
+
+  // two buckets at least, so every key has two different ones
+  static int capacityFor(int capacity) {
+    return std::max(2, (capacity + Ways - 1) / Ways) * Ways;
+  }
+
+private:
+  static uint32_t secondBucket(uint32_t hash, uint32_t firstBucket, int buckets) {
+    // the high bits of another multiplicative hash, scaled down without a division
+    auto mixed = (hash * 0x9e3779b97f4a7c15ull) >> 32;
+    auto bucket = static_cast<uint32_t>((mixed * static_cast<uint64_t>(buckets)) >> 32);
+    return bucket != firstBucket ? bucket : (bucket + 1) % static_cast<uint32_t>(buckets);
+  }
+};
+
+static const int CacheLineSize = 64;
+
+// Layout policies decide how cells sit in memory, in memory that an allocation
+// policy hands out (see allocation.h). A storage loads the key of cell
+// idx (loadKey), claims an empty cell for a key (claimKey, or claim to publish a
+// value along with it), hands out cells through cellAt and prefetches the lines of
+// a cell. The claims take the key the cell is expected to hold, and on failure
+// leave in it the key the cell holds. A cell is anything that compares to nullptr
+// and gives access to ->key and ->value.
+
+// key and value side by side, a hit costs a single cache line
+struct interleaved_layout {
+  enum { Id = 1 };
+
+  template <typename KeyType, typename ValueType, typename AllocationType = heap_allocation>
+  class storage {
+  public:
+    using CellType = Element<KeyType, ValueType>*;
+
+    static size_t bytesFor(int size) { return size * sizeof(Element<KeyType, ValueType>); }
+
+    storage(int size, KeyType emptyKey, ValueType emptyValue, const PlacedCells* placed = nullptr):
+      m_memory(bytesFor(size), placed),
+      m_data(reinterpret_cast<Element<KeyType, ValueType>*>(m_memory.get())) {
+      if (m_memory.skipsClearing(emptyKey, emptyValue)) return;
+
+      for (int i = 0; i < size; ++i) {
+        new (&m_data[i].key) std::atomic<KeyType>(emptyKey);
+        new (&m_data[i].value) std::atomic<ValueType>(emptyValue);
+      }
+    }
+
+    // atomics of trivially copyable types have nothing to destroy, CellMemory
+    // gives the memory back
+
+    KeyType loadKey(int idx) { return m_data[idx].key.load(std::memory_order::memory_order_acquire); }
+    bool claimKey(int idx, KeyType& expected, KeyType k) { return m_data[idx].key.compare_exchange_strong(expected, k); }
+
+    // two steps, a reader may see the key with the default value in between
+    bool claim(int idx, KeyType& expected, KeyType k, ValueType v, ValueType& previous) {
+      if (!claimKey(idx, expected, k)) return false;
+      previous = m_data[idx].value.exchange(v, std::memory_order::memory_order_release);
+      return true;
+    }
+
+    CellType cellAt(int idx) { return &m_data[idx]; }
+
+    void prefetch(int idx, bool forWrite) {
+      if (forWrite) __builtin_prefetch(&m_data[idx], 1);
+      else __builtin_prefetch(&m_data[idx], 0);
+    }
+
+  private:
+    CellMemory<AllocationType> m_memory;
+    Element<KeyType, ValueType>* m_data;
+  };
+};
+
+// Cell of a layout that keeps keys and values apart.
+template <typename KeyType, typename ValueType>
+class SplitCell {
 public:
-  Table(int size, int freeCells): m_size(size), m_freeCells(freeCells), m_heldKeys(0){
+  struct Ref {
+    std::atomic<KeyType>& key;
+    std::atomic<ValueType>& value;
+
+    Ref* operator->() { return this; }
+  };
+
+  SplitCell(std::nullptr_t = nullptr): m_key(nullptr), m_value(nullptr) {}
+  SplitCell(std::atomic<KeyType>* key, std::atomic<ValueType>* value): m_key(key), m_value(value) {}
+
+  Ref operator->() const { return Ref{ *m_key, *m_value }; }
+
+  bool operator==(const SplitCell& other) const { return m_key == other.m_key; }
+  bool operator!=(const SplitCell& other) const { return m_key != other.m_key; }
+  friend bool operator==(std::nullptr_t, const SplitCell& cell) { return cell.m_key == nullptr; }
+  friend bool operator!=(std::nullptr_t, const SplitCell& cell) { return cell.m_key != nullptr; }
+
+private:
+  std::atomic<KeyType>* m_key;
+  std::atomic<ValueType>* m_value;
+};
+
+// Keys packed into cache line aligned groups, values in an array of their own, so a
+// probe only pulls in keys and a whole cache line of candidates at a time. Both
+// arrays share one block of memory, the values start at the first cache line after
+// the keys.
+struct split_layout {
+  enum { Id = 2 };
+
+  template <typename KeyType, typename ValueType, typename AllocationType = heap_allocation>
+  class storage {
+  public:
+    using CellType = SplitCell<KeyType, ValueType>;
+
+    static size_t bytesFor(int size) { return valuesOffset(size) + size * sizeof(std::atomic<ValueType>); }
+
+    storage(int size, KeyType emptyKey, ValueType emptyValue, const PlacedCells* placed = nullptr):
+      m_memory(bytesFor(size), placed) {
+      auto address = reinterpret_cast<uintptr_t>(m_memory.get());
+      m_keys = reinterpret_cast<std::atomic<KeyType>*>((address + CacheLineSize - 1) & ~static_cast<uintptr_t>(CacheLineSize - 1));
+      m_values = reinterpret_cast<std::atomic<ValueType>*>(m_memory.get() + valuesOffset(size));
+
+      if (m_memory.skipsClearing(emptyKey, emptyValue)) return;
+
+      for (int i = 0; i < size; ++i) {
+        new (&m_keys[i]) std::atomic<KeyType>(emptyKey);
+        new (&m_values[i]) std::atomic<ValueType>(emptyValue);
+      }
+    }
+
+    KeyType loadKey(int idx) { return m_keys[idx].load(std::memory_order::memory_order_acquire); }
+    bool claimKey(int idx, KeyType& expected, KeyType k) { return m_keys[idx].compare_exchange_strong(expected, k); }
+
+    bool claim(int idx, KeyType& expected, KeyType k, ValueType v, ValueType& previous) {
+      if (!claimKey(idx, expected, k)) return false;
+      previous = m_values[idx].exchange(v, std::memory_order::memory_order_release);
+      return true;
+    }
+
+    CellType cellAt(int idx) { return CellType(&m_keys[idx], &m_values[idx]); }
+
+    // the value is read on a hit, or written, so its line is wanted as well
+    void prefetch(int idx, bool forWrite) {
+      __builtin_prefetch(&m_keys[idx], 0);
+      if (forWrite) __builtin_prefetch(&m_values[idx], 1);
+      else __builtin_prefetch(&m_values[idx], 0);
+    }
+
+  private:
+    // room to align the keys to a cache line, then the values on a line of their own
+    static size_t valuesOffset(int size) {
+      auto keysBytes = size * sizeof(std::atomic<KeyType>) + CacheLineSize;
+      return (keysBytes + CacheLineSize - 1) / CacheLineSize * CacheLineSize;
+    }
+
+    CellMemory<AllocationType> m_memory;
+    std::atomic<KeyType>* m_keys;
+    std::atomic<ValueType>* m_values;
+  };
+};
+
+// Key and value of a cell packed into one 64 bit word: the key in the low bytes,
+// the value right after it. The unused bytes stay zero, so equal pairs always make
+// equal words.
+template <typename KeyType, typename ValueType>
+struct PackedWord {
+  static_assert(sizeof(KeyType) + sizeof(ValueType) <= sizeof(uint64_t), "key and value don't fit in a word");
+
+  static uint64_t pack(KeyType k, ValueType v) {
+    uint64_t word = 0;
+    std::memcpy(&word, &k, sizeof(KeyType));
+    std::memcpy(reinterpret_cast<char*>(&word) + sizeof(KeyType), &v, sizeof(ValueType));
+    return word;
+  }
+
+  static KeyType key(uint64_t word) {
+    KeyType k;
+    std::memcpy(&k, &word, sizeof(KeyType));
+    return k;
+  }
+
+  static ValueType value(uint64_t word) {
+    ValueType v;
+    std::memcpy(&v, reinterpret_cast<const char*>(&word) + sizeof(KeyType), sizeof(ValueType));
+    return v;
+  }
+};
+
+// Cell of the packed layout. Its key and value look like atomics of their own, every
+// write is a CAS of the whole word that keeps the other half as it was.
+template <typename KeyType, typename ValueType>
+class PackedCell {
+  using Word = PackedWord<KeyType, ValueType>;
+
+public:
+  class Key {
+  public:
+    explicit Key(std::atomic<uint64_t>* word): m_word(word) {}
+
+    KeyType load(std::memory_order order = std::memory_order::memory_order_seq_cst) const {
+      return Word::key(m_word->load(order));
+    }
+
+  private:
+    std::atomic<uint64_t>* m_word;
+  };
+
+  class Value {
+  public:
+    explicit Value(std::atomic<uint64_t>* word): m_word(word) {}
+
+    ValueType load(std::memory_order order = std::memory_order::memory_order_seq_cst) const {
+      return Word::value(m_word->load(order));
+    }
+
+    void store(ValueType v, std::memory_order order = std::memory_order::memory_order_seq_cst) {
+      exchange(v, order);
+    }
+
+    ValueType exchange(ValueType v, std::memory_order = std::memory_order::memory_order_seq_cst) {
+      auto word = m_word->load(std::memory_order::memory_order_relaxed);
+      while (!m_word->compare_exchange_weak(word, Word::pack(Word::key(word), v))) {}
+      return Word::value(word);
+    }
+
+    bool compare_exchange_strong(ValueType& expected, ValueType desired, std::memory_order = std::memory_order::memory_order_seq_cst) {
+      auto word = m_word->load(std::memory_order::memory_order_relaxed);
+      for (;;) {
+        if (Word::value(word) != expected) {
+          expected = Word::value(word);
+          return false;
+        }
+        if (m_word->compare_exchange_weak(word, Word::pack(Word::key(word), desired))) {
+          return true;
+        }
+      }
+    }
+
+  private:
+    std::atomic<uint64_t>* m_word;
+  };
+
+  struct Ref {
+    Key key;
+    Value value;
+
+    Ref* operator->() { return this; }
+  };
+
+  PackedCell(std::nullptr_t = nullptr): m_word(nullptr) {}
+  explicit PackedCell(std::atomic<uint64_t>* word): m_word(word) {}
+
+  Ref operator->() const { return Ref{ Key(m_word), Value(m_word) }; }
+
+  bool operator==(const PackedCell& other) const { return m_word == other.m_word; }
+  bool operator!=(const PackedCell& other) const { return m_word != other.m_word; }
+  friend bool operator==(std::nullptr_t, const PackedCell& cell) { return cell.m_word == nullptr; }
+  friend bool operator!=(std::nullptr_t, const PackedCell& cell) { return cell.m_word != nullptr; }
+
+private:
+  std::atomic<uint64_t>* m_word;
+};
+
+// One word per cell when key and value fit in it together, interleaved otherwise.
+// A cell is claimed and its value published by the same CAS, so readers never see
+// a claimed key without its value, and a cell costs a single atomic.
+struct packed_layout {
+  enum { Id = 3 };
+
+  template <typename KeyType, typename ValueType, typename AllocationType>
+  class word_storage {
+    using Word = PackedWord<KeyType, ValueType>;
+
+  public:
+    using CellType = PackedCell<KeyType, ValueType>;
+
+    static size_t bytesFor(int size) { return size * sizeof(std::atomic<uint64_t>); }
+
+    word_storage(int size, KeyType emptyKey, ValueType emptyValue, const PlacedCells* placed = nullptr):
+      m_emptyValue(emptyValue), m_memory(bytesFor(size), placed),
+      m_words(reinterpret_cast<std::atomic<uint64_t>*>(m_memory.get())) {
+      if (m_memory.skipsClearing(emptyKey, emptyValue)) return;
+
+      auto empty = Word::pack(emptyKey, emptyValue);
+      for (int i = 0; i < size; ++i) {
+        new (&m_words[i]) std::atomic<uint64_t>(empty);
+      }
+    }
+
+    KeyType loadKey(int idx) { return Word::key(m_words[idx].load(std::memory_order::memory_order_acquire)); }
+
+    // a cell nobody claimed still holds the default value
+    bool claimKey(int idx, KeyType& expected, KeyType k) {
+      ValueType previous;
+      return claim(idx, expected, k, m_emptyValue, previous);
+    }
+
+    bool claim(int idx, KeyType& expected, KeyType k, ValueType v, ValueType& previous) {
+      auto word = Word::pack(expected, m_emptyValue);
+      if (m_words[idx].compare_exchange_strong(word, Word::pack(k, v))) {
+        previous = m_emptyValue;
+        return true;
+      }
+      expected = Word::key(word);
+      return false;
+    }
+
+    CellType cellAt(int idx) { return CellType(&m_words[idx]); }
+
+    void prefetch(int idx, bool forWrite) {
+      if (forWrite) __builtin_prefetch(&m_words[idx], 1);
+      else __builtin_prefetch(&m_words[idx], 0);
+    }
+
+  private:
+    ValueType m_emptyValue;
+    CellMemory<AllocationType> m_memory;
+    std::atomic<uint64_t>* m_words;
+  };
+
+  template <typename KeyType, typename ValueType>
+  struct fits {
+    enum { value = sizeof(KeyType) + sizeof(ValueType) <= sizeof(uint64_t) &&
+                   std::is_trivially_copyable<KeyType>::value && std::is_trivially_copyable<ValueType>::value };
+  };
+
+  template <typename KeyType, typename ValueType, typename AllocationType = heap_allocation>
+  using storage = typename std::conditional<fits<KeyType, ValueType>::value,
+                                            word_storage<KeyType, ValueType, AllocationType>,
+                                            interleaved_layout::storage<KeyType, ValueType, AllocationType>>::type;
+};
+
+template <typename KeyType, typename ValueType, typename KeyTraitsType = key_traits<KeyType>, typename ValueTraitsType = value_traits<ValueType>, typename IndexingType = modulo_indexing,
+          typename LayoutType = packed_layout, typename AllocationType = heap_allocation, typename ProbingType = linear_probing>
+class Table {
+  using StorageType = typename LayoutType::template storage<KeyType, ValueType, AllocationType>;
+
+  static int checkedCapacity(int size, int freeCells) {
     if (size == 0) throw std::invalid_argument("size argument cannot be 0");
     if (size < 0) throw std::invalid_argument("size argument cannot be negative");
-    if (size < freeCells) throw std::invalid_argument("size must not be less than freeCells");
 
-    m_data = new Element<KeyType, ValueType>[size];
-    for (int i = 0; i < size; ++i) {
-      m_data[i].value = ValueTraitsType::defaultValue();
-      m_data[i].key = KeyTraitsType::defaultValue();
-    }
+    auto capacity = capacityFor(size);
+    if (capacity < freeCells) throw std::invalid_argument("size must not be less than freeCells");
+    return capacity;
   }
 
+public:
+  using CellType = typename StorageType::CellType;
+
+  enum { LayoutId = LayoutType::Id, ProbingId = ProbingType::Id };
+
+  static int capacityFor(int size) { return ProbingType::capacityFor(IndexingType::capacityFor(size)); }
+
+  // bytes the cells of a table of the given capacity take up
+  static size_t cellBytes(int capacity) { return StorageType::bytesFor(capacity); }
+
+  Table(int size, int freeCells):
+    m_size(checkedCapacity(size, freeCells)), m_freeCells(freeCells), m_heldKeys(0), m_migratedCells(0), m_retiredAt(std::numeric_limits<uint64_t>::max()), m_filter(nullptr), m_olderTable(nullptr),
+    m_data(m_size, KeyTraitsType::defaultValue(), ValueTraitsType::defaultValue()) {}
+
+  // A table over cells placed in memory of cellBytes(capacity), see PlacedCells.
+  // Placed cells that hold a table come with the counters they were saved with.
+  Table(int capacity, int freeCells, int heldKeys, const PlacedCells& placed):
+    m_size(checkedCapacity(capacity, freeCells)), m_freeCells(freeCells), m_heldKeys(heldKeys), m_migratedCells(0), m_retiredAt(std::numeric_limits<uint64_t>::max()), m_filter(nullptr), m_olderTable(nullptr),
+    m_data(m_size, KeyTraitsType::defaultValue(), ValueTraitsType::defaultValue(), &placed) {}
+
   ~Table() {
-    delete[] m_data;
+    delete m_filter.load();
   }
 
-  Element<KeyType, ValueType>* fillFirstCellFor(KeyType k) {
-    auto totalCells = m_size;
+  // Keys are never taken out of a cell: a removed key stays behind with the default
+  // value as a tombstone. That keeps every probe chain intact, so a probe can stop at
+  // the first cell that was never used.
+  CellType fillFirstCellFor(KeyType k) {
+    return fillFirstCellFor(k, KeyTraitsType::hash(k));
+  }
 
-    for (auto idx = KeyTraitsType::hash(k); totalCells > 0; ++idx, --totalCells) {
-      idx %= m_size;
-      auto currCellKey = std::atomic_load_explicit(&m_data[idx].key, std::memory_order::memory_order_relaxed);
+  // hash has to be KeyTraitsType::hash(k), callers that already have it skip rehashing
+  CellType fillFirstCellFor(KeyType k, uint32_t hash) {
+    bool claimed;
+    return fillFirstCellFor(k, hash, claimed);
+  }
 
-      if ((currCellKey == k) ||
-         (currCellKey == KeyTraitsType::defaultValue() && std::atomic_compare_exchange_strong(&m_data[idx].key, &currCellKey, k))) {
-        return &m_data[idx];
+  // claimed tells whether the cell was taken from the empty ones, rather than found
+  // holding k already, e.g. as a tombstone
+  // nullptr if none of the cells the probing policy allows is left for k
+  CellType fillFirstCellFor(KeyType k, uint32_t hash, bool& claimed) {
+    auto limit = ProbingType::limit(m_size);
+    claimed = false;
+
+    auto idx = ProbingType::template first<IndexingType>(hash, m_size);
+    for (auto probe = 1; probe <= limit; idx = nextCell(idx, probe, hash), ++probe) {
+      auto currCellKey = m_data.loadKey(idx);
+
+      if (currCellKey == KeyTraitsType::defaultValue()) {
+        // losing the race to a thread that claims the cell for the same key is fine
+        if (m_data.claimKey(idx, currCellKey, k)) {
+          probe_stats::record(probe);
+          claimed = true;
+          return m_data.cellAt(idx);
+        }
+
+        probe_stats::casFailed();
+        if (key_equality<KeyTraitsType>::equal(currCellKey, k)) {
+          probe_stats::record(probe);
+          return m_data.cellAt(idx);
+        }
+      } else if (key_equality<KeyTraitsType>::equal(currCellKey, k)) {
+        probe_stats::record(probe);
+        return m_data.cellAt(idx);
       }
     }
+    probe_stats::record(limit);
     return nullptr;
   }
 
-  Element<KeyType, ValueType>* findFirstCellFor(KeyType k) {
-    auto totalCells = m_size;
+  // Claims a cell for k and sets its value, previous gets the value it replaced.
+  // With a layout that packs the pair, a new key and its value go in with one CAS.
+  CellType insertOrAssign(KeyType k, uint32_t hash, ValueType v, ValueType& previous) {
+    bool claimed;
+    return insertOrAssign(k, hash, v, previous, claimed);
+  }
 
-    for (auto idx = KeyTraitsType::hash(k); totalCells > 0; ++idx, --totalCells) {
-      idx %= m_size;
-      auto currCellKey = std::atomic_load_explicit(&m_data[idx].key, std::memory_order::memory_order_relaxed);
+  // claimed as for fillFirstCellFor
+  CellType insertOrAssign(KeyType k, uint32_t hash, ValueType v, ValueType& previous, bool& claimed) {
+    auto limit = ProbingType::limit(m_size);
+    claimed = false;
+
+    auto idx = ProbingType::template first<IndexingType>(hash, m_size);
+    for (auto probe = 1; probe <= limit; idx = nextCell(idx, probe, hash), ++probe) {
+      auto currCellKey = m_data.loadKey(idx);
+
+      if (currCellKey == KeyTraitsType::defaultValue()) {
+        if (m_data.claim(idx, currCellKey, k, v, previous)) {
+          probe_stats::record(probe);
+          claimed = true;
+          return m_data.cellAt(idx);
+        }
+        probe_stats::casFailed();
+      }
 
-      if (currCellKey == k) {
-        return &m_data[idx];
+      if (key_equality<KeyTraitsType>::equal(currCellKey, k)) {
+        probe_stats::record(probe);
+        auto cell = m_data.cellAt(idx);
+        previous = cell->value.exchange(v, std::memory_order::memory_order_release);
+        return cell;
       }
     }
+    probe_stats::record(limit);
     return nullptr;
   }
 
+  CellType findFirstCellFor(KeyType k) {
+    return findFirstCellFor(k, KeyTraitsType::hash(k));
+  }
+
+  CellType findFirstCellFor(KeyType k, uint32_t hash) {
+    auto limit = ProbingType::limit(m_size);
+
+    auto idx = ProbingType::template first<IndexingType>(hash, m_size);
+    for (auto probe = 1; probe <= limit; idx = nextCell(idx, probe, hash), ++probe) {
+      auto currCellKey = m_data.loadKey(idx);
+
+      if (currCellKey == KeyTraitsType::defaultValue()) {
+        probe_stats::record(probe);
+        return nullptr;
+      }
+
+      if (key_equality<KeyTraitsType>::equal(currCellKey, k)) {
+        probe_stats::record(probe);
+        return m_data.cellAt(idx);
+      }
+    }
+    probe_stats::record(limit);
+    return nullptr;
+  }
+
+  CellType cellAt(int idx) {
+    return m_data.cellAt(idx);
+  }
+
+  // pulls in the home cell of a hash ahead of a probe
+  void prefetch(uint32_t hash, bool forWrite) {
+    m_data.prefetch(ProbingType::template first<IndexingType>(hash, m_size), forWrite);
+  }
+
+private:
+  uint32_t nextCell(uint32_t idx, int probe, uint32_t hash) const {
+    return ProbingType::template next<IndexingType>(idx, probe, hash, m_size);
+  }
+
+public:
   int m_size;
   std::atomic<int> m_freeCells;
   std::atomic<int> m_heldKeys;
-  Element<KeyType, ValueType>* m_data;
+  std::atomic<int> m_migratedCells;
+  // grace period token of when the table stopped being active, set by the map
+  std::atomic<uint64_t> m_retiredAt;
+  // the keys of a retired table, built by the map once no new ones can come in
+  std::atomic<KeyFilter*> m_filter;
+  // the next older retired table, the map chains its old tables through it
+  std::atomic<Table*> m_olderTable;
+  StorageType m_data;
 };
 
 template <typename KeyType, typename ValueType, typename ValueTraitsType = value_traits<ValueType>>
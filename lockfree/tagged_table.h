@@ -0,0 +1,257 @@
+#ifndef TAGGED_TABLE_H
+#define TAGGED_TABLE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+#include "table.h"
+
+#if !defined(LOCKFREE_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define LOCKFREE_TAGS_AVX2
+#elif !defined(LOCKFREE_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define LOCKFREE_TAGS_SSE2
+#endif
+
+// A group of control bytes, compared against a tag all at once.
+// The vector loads read bytes other threads may be storing to. Single bytes are
+// never torn on the targets these paths compile for, and a stale byte only ever
+// reads as empty, which the probes below double check against the key.
+struct TagGroup {
+#if defined(LOCKFREE_TAGS_AVX2)
+  enum { Width = 32 };
+
+  explicit TagGroup(const std::atomic<uint8_t>* ctrl): m_bytes(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ctrl))) {}
+
+  uint32_t match(uint8_t tag) const {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(m_bytes, _mm256_set1_epi8(static_cast<char>(tag)))));
+  }
+
+  __m256i m_bytes;
+#elif defined(LOCKFREE_TAGS_SSE2)
+  enum { Width = 16 };
+
+  explicit TagGroup(const std::atomic<uint8_t>* ctrl): m_bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl))) {}
+
+  uint32_t match(uint8_t tag) const {
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(m_bytes, _mm_set1_epi8(static_cast<char>(tag)))));
+  }
+
+  __m128i m_bytes;
+#else
+  enum { Width = 8 };
+
+  explicit TagGroup(const std::atomic<uint8_t>* ctrl) {
+    for (int i = 0; i < Width; ++i) {
+      m_bytes[i] = ctrl[i].load(std::memory_order::memory_order_relaxed);
+    }
+  }
+
+  uint32_t match(uint8_t tag) const {
+    uint32_t mask = 0;
+    for (int i = 0; i < Width; ++i) {
+      mask |= static_cast<uint32_t>(m_bytes[i] == tag) << i;
+    }
+    return mask;
+  }
+
+  uint8_t m_bytes[Width];
+#endif
+};
+
+// Open addressing table that keeps a 7 bit tag of every key's hash in a control
+// byte array, SwissTable style. A probe compares a whole group of tags at once and
+// only reads the keys whose tag matched. Claiming a cell is the key CAS, same as in
+// Table, the tag is published right after, so for a short while a claimed cell can
+// still show up as empty. Probes check the key of such cells before trusting them.
+template <typename KeyType, typename ValueType, typename KeyTraitsType = key_traits<KeyType>, typename ValueTraitsType = value_traits<ValueType>, typename IndexingType = modulo_indexing>
+class TaggedTable {
+  static_assert(sizeof(std::atomic<uint8_t>) == 1, "control bytes must be plain bytes");
+
+  static const uint8_t EmptyTag = 0x80;
+  enum { GroupWidth = TagGroup::Width };
+
+  static int checkedCapacity(int size, int freeCells) {
+    if (size == 0) throw std::invalid_argument("size argument cannot be 0");
+    if (size < 0) throw std::invalid_argument("size argument cannot be negative");
+
+    auto capacity = capacityFor(size);
+    if (capacity < freeCells) throw std::invalid_argument("size must not be less than freeCells");
+    return capacity;
+  }
+
+  static uint8_t tagOf(uint32_t hash) {
+    return static_cast<uint8_t>(hash >> 25);
+  }
+
+public:
+  using CellType = Element<KeyType, ValueType>*;
+
+  // a group never wraps around, so there is at least a group worth of cells
+  static int capacityFor(int size) { return std::max(IndexingType::capacityFor(size), static_cast<int>(GroupWidth)); }
+
+  TaggedTable(int size, int freeCells): m_size(checkedCapacity(size, freeCells)), m_freeCells(freeCells), m_heldKeys(0), m_migratedCells(0),
+    m_retiredAt(std::numeric_limits<uint64_t>::max()), m_filter(nullptr), m_olderTable(nullptr) {
+    m_data = new Element<KeyType, ValueType>[m_size];
+    for (int i = 0; i < m_size; ++i) {
+      m_data[i].value = ValueTraitsType::defaultValue();
+      m_data[i].key = KeyTraitsType::defaultValue();
+    }
+
+    // the first GroupWidth - 1 tags are mirrored past the end, a group loaded
+    // near the end of the table then reads on into the mirror instead of wrapping
+    m_ctrl = new std::atomic<uint8_t>[m_size + GroupWidth - 1];
+    for (int i = 0; i < m_size + GroupWidth - 1; ++i) {
+      m_ctrl[i].store(EmptyTag, std::memory_order::memory_order_relaxed);
+    }
+  }
+
+  ~TaggedTable() {
+    delete m_filter.load();
+    delete[] m_data;
+    delete[] m_ctrl;
+  }
+
+  CellType fillFirstCellFor(KeyType k) {
+    return fillFirstCellFor(k, KeyTraitsType::hash(k));
+  }
+
+  CellType fillFirstCellFor(KeyType k, uint32_t hash) {
+    bool claimed;
+    return fillFirstCellFor(k, hash, claimed);
+  }
+
+  // claimed tells whether the cell was taken from the empty ones
+  CellType fillFirstCellFor(KeyType k, uint32_t hash, bool& claimed) {
+    auto tag = tagOf(hash);
+    claimed = false;
+
+    auto idx = IndexingType::home(hash, m_size);
+    for (auto probed = 0; probed < m_size; probed += GroupWidth) {
+      TagGroup group(&m_ctrl[idx]);
+
+      // tag matches and empty cells, in probe order
+      for (auto candidates = group.match(tag) | group.match(EmptyTag); candidates != 0; candidates &= candidates - 1) {
+        auto pos = wrap(idx + lowestBit(candidates));
+        auto currCellKey = m_data[pos].key.load(std::memory_order::memory_order_acquire);
+
+        if (currCellKey == KeyTraitsType::defaultValue()) {
+          if (m_data[pos].key.compare_exchange_strong(currCellKey, k)) {
+            publishTag(pos, tag);
+            probe_stats::record(groupsProbed(probed));
+            claimed = true;
+            return &m_data[pos];
+          }
+          probe_stats::casFailed();
+        }
+
+        // claimed by someone else for the same key, maybe without a tag yet
+        if (key_equality<KeyTraitsType>::equal(currCellKey, k)) {
+          probe_stats::record(groupsProbed(probed));
+          return &m_data[pos];
+        }
+      }
+
+      idx = wrap(idx + GroupWidth);
+    }
+    probe_stats::record(groupsProbed(m_size - 1));
+    return nullptr;
+  }
+
+  CellType insertOrAssign(KeyType k, uint32_t hash, ValueType v, ValueType& previous) {
+    bool claimed;
+    return insertOrAssign(k, hash, v, previous, claimed);
+  }
+
+  CellType insertOrAssign(KeyType k, uint32_t hash, ValueType v, ValueType& previous, bool& claimed) {
+    auto cell = fillFirstCellFor(k, hash, claimed);
+    if (cell != nullptr) {
+      previous = cell->value.exchange(v, std::memory_order::memory_order_release);
+    }
+    return cell;
+  }
+
+  CellType findFirstCellFor(KeyType k) {
+    return findFirstCellFor(k, KeyTraitsType::hash(k));
+  }
+
+  CellType findFirstCellFor(KeyType k, uint32_t hash) {
+    auto tag = tagOf(hash);
+
+    auto idx = IndexingType::home(hash, m_size);
+    for (auto probed = 0; probed < m_size; probed += GroupWidth) {
+      TagGroup group(&m_ctrl[idx]);
+
+      for (auto candidates = group.match(tag) | group.match(EmptyTag); candidates != 0; candidates &= candidates - 1) {
+        auto pos = wrap(idx + lowestBit(candidates));
+        auto currCellKey = m_data[pos].key.load(std::memory_order::memory_order_acquire);
+
+        // an empty tag over a claimed key is a tag that is still being published
+        if (currCellKey == KeyTraitsType::defaultValue()) {
+          probe_stats::record(groupsProbed(probed));
+          return nullptr;
+        }
+
+        if (key_equality<KeyTraitsType>::equal(currCellKey, k)) {
+          probe_stats::record(groupsProbed(probed));
+          return &m_data[pos];
+        }
+      }
+
+      idx = wrap(idx + GroupWidth);
+    }
+    probe_stats::record(groupsProbed(m_size - 1));
+    return nullptr;
+  }
+
+  CellType cellAt(int idx) {
+    return &m_data[idx];
+  }
+
+  void prefetch(uint32_t hash, bool forWrite) {
+    auto home = IndexingType::home(hash, m_size);
+    __builtin_prefetch(&m_ctrl[home], 0);
+    if (forWrite) __builtin_prefetch(&m_data[home], 1);
+    else __builtin_prefetch(&m_data[home], 0);
+  }
+
+  int m_size;
+  std::atomic<int> m_freeCells;
+  std::atomic<int> m_heldKeys;
+  std::atomic<int> m_migratedCells;
+  // grace period token of when the table stopped being active, set by the map
+  std::atomic<uint64_t> m_retiredAt;
+  // the keys of a retired table, built by the map once no new ones can come in
+  std::atomic<KeyFilter*> m_filter;
+  // the next older retired table, the map chains its old tables through it
+  std::atomic<TaggedTable*> m_olderTable;
+  Element<KeyType, ValueType>* m_data;
+  std::atomic<uint8_t>* m_ctrl;
+
+private:
+  uint32_t wrap(uint32_t idx) const {
+    return idx >= static_cast<uint32_t>(m_size) ? idx - m_size : idx;
+  }
+
+  // probe lengths of this table count groups rather than cells
+  static int groupsProbed(int cellsBefore) {
+    return cellsBefore / GroupWidth + 1;
+  }
+
+  static int lowestBit(uint32_t mask) {
+    return __builtin_ctz(mask);
+  }
+
+  void publishTag(uint32_t pos, uint8_t tag) {
+    m_ctrl[pos].store(tag, std::memory_order::memory_order_release);
+    if (pos < static_cast<uint32_t>(GroupWidth - 1)) {
+      m_ctrl[m_size + pos].store(tag, std::memory_order::memory_order_release);
+    }
+  }
+};
+
+#endif // TAGGED_TABLE_H
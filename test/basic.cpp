@@ -1,5 +1,6 @@
 #include "gtest/gtest.h"
 #include "lockfree/lockfree.h"
+#include <vector>
 
 class BasicTests : public ::testing::Test {
 public:
@@ -61,4 +62,155 @@ TEST_F(BasicTests, Get_fails_when_map_is_full_and_item_doesnt_exist) {
   EXPECT_EQ(0, m -> get(6));
 }
 
+TEST_F(BasicTests, Misses_dont_take_up_cells) {
+  for (int i = 1; i <= 100; ++i) {
+    EXPECT_EQ(0, m -> get(i));
+  }
+
+  EXPECT_EQ(101, m -> insert(101, 101));
+  EXPECT_EQ(101, m -> get(101));
+}
+
 // auto-growth tests
+
+TEST_F(BasicTests, Values_survive_several_growths) {
+  for (int i = 1; i <= 1000; ++i) {
+    m -> insert(i, i * 10);
+  }
+
+  for (int i = 1; i <= 1000; ++i) {
+    EXPECT_EQ(i * 10, m -> get(i));
+  }
+}
+
+TEST_F(BasicTests, Newest_value_wins_after_migration) {
+  m -> insert(1, 1);
+  for (int i = 2; i <= 100; ++i) {
+    m -> insert(i, i);
+  }
+  m -> insert(1, 2);
+  for (int i = 101; i <= 1000; ++i) {
+    m -> insert(i, i);
+  }
+
+  EXPECT_EQ(2, m -> get(1));
+}
+
+TEST_F(BasicTests, Removed_values_dont_come_back_with_the_migration) {
+  for (int i = 1; i <= 100; ++i) {
+    m -> insert(i, i);
+  }
+  for (int i = 1; i <= 50; ++i) {
+    EXPECT_EQ(i, m -> remove(i));
+  }
+
+  // every operation migrates a chunk, this drains whatever is left behind
+  for (int round = 0; round < 10; ++round) {
+    for (int i = 1; i <= 100; ++i) {
+      EXPECT_EQ(i > 50 ? i : 0, m -> get(i));
+    }
+  }
+}
+
+TEST_F(BasicTests, Insert_many_and_get_many) {
+  std::vector<int> keys, values;
+  for (int i = 1; i <= 1000; ++i) {
+    keys.push_back(i * 7);
+    values.push_back(i);
+  }
+
+  m -> insertMany(keys.data(), values.data(), keys.size());
+
+  std::vector<int> found(keys.size());
+  m -> getMany(keys.data(), found.data(), keys.size());
+  EXPECT_EQ(values, found);
+}
+
+TEST_F(BasicTests, Get_many_with_misses_and_a_partial_batch) {
+  m -> insert(1, 11);
+  m -> insert(3, 13);
+
+  int keys[] = { 1, 2, 3 };
+  int found[] = { -1, -1, -1 };
+  m -> getMany(keys, found, 3);
+
+  EXPECT_EQ(11, found[0]);
+  EXPECT_EQ(0, found[1]);
+  EXPECT_EQ(13, found[2]);
+}
+
+// read-modify-write tests
+
+TEST_F(BasicTests, Fetch_add_counts_from_a_missing_key) {
+  EXPECT_EQ(0, m -> fetchAdd(1, 5));
+  EXPECT_EQ(5, m -> fetchAdd(1, 2));
+  EXPECT_EQ(7, m -> get(1));
+}
+
+TEST_F(BasicTests, Compare_exchange_reports_the_current_value) {
+  m -> insert(1, 10);
+
+  int expected = 11;
+  EXPECT_FALSE(m -> compareExchange(1, expected, 20));
+  EXPECT_EQ(10, expected);
+  EXPECT_TRUE(m -> compareExchange(1, expected, 20));
+  EXPECT_EQ(20, m -> get(1));
+
+  // exchanging in the default value removes the key
+  expected = 20;
+  EXPECT_TRUE(m -> compareExchange(1, expected, 0));
+  EXPECT_EQ(0, m -> get(1));
+}
+
+TEST_F(BasicTests, Upsert_sees_values_of_old_tables) {
+  for (int i = 1; i <= 1000; ++i) {
+    m -> insert(i, i);
+  }
+  for (int i = 1; i <= 1000; ++i) {
+    EXPECT_EQ(i * 3, m -> upsert(i, [](int v) { return v * 3; }));
+  }
+  for (int i = 1; i <= 1000; ++i) {
+    EXPECT_EQ(i * 3, m -> get(i));
+  }
+}
+
+TEST_F(BasicTests, Live_keys_survive_compactions) {
+  for (int k = 1; k <= 20000; ++k) {
+    m -> insert(k, k);
+    if (k > 5 && k % 100 != 0) m -> remove(k - 5);
+  }
+
+  for (int k = 1; k <= 20000; ++k) {
+    auto kept = k > 19995 || (k + 5) % 100 == 0;
+    EXPECT_EQ(kept ? k : 0, m -> get(k)) << "key " << k;
+  }
+}
+
+// bulk loading tests
+
+TEST(BulkLoadTests, Range_constructor_holds_every_pair) {
+  std::vector<std::pair<int, int>> pairs;
+  for (int k = 1; k <= 50000; ++k) {
+    pairs.push_back(std::make_pair(k, k * 2));
+  }
+
+  LockFreeMap<int, int> m(pairs.begin(), pairs.end());
+  for (int k = 1; k <= 50000; ++k) {
+    EXPECT_EQ(k * 2, m.get(k)) << "key " << k;
+  }
+}
+
+TEST(BulkLoadTests, Generated_pairs_join_the_keys_already_there) {
+  LockFreeMap<int, int> m(16);
+  for (int k = -100; k < 0; ++k) {
+    m.insert(k, 1);
+  }
+
+  m.bulkLoad(100000, [](size_t i) { return std::make_pair(static_cast<int>(i) + 1, static_cast<int>(i) + 2); }, 4);
+  for (int k = -100; k < 0; ++k) {
+    EXPECT_EQ(1, m.get(k));
+  }
+  for (int k = 1; k <= 100000; ++k) {
+    EXPECT_EQ(k + 1, m.get(k)) << "key " << k;
+  }
+}
@@ -0,0 +1,121 @@
+#include "gtest/gtest.h"
+#include "lockfree/cache.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(CacheTests, Insert_get_and_remove) {
+  LockFreeCache<int, int> c(64);
+
+  EXPECT_EQ(0, c.get(1));
+  EXPECT_EQ(11, c.insert(1, 11));
+  EXPECT_EQ(11, c.get(1));
+  EXPECT_EQ(12, c.insert(1, 12));
+  EXPECT_EQ(12, c.get(1));
+  EXPECT_EQ(1, c.size());
+  EXPECT_EQ(12, c.remove(1));
+  EXPECT_EQ(0, c.get(1));
+  EXPECT_EQ(0, c.size());
+}
+
+TEST(CacheTests, Capacity_holds_however_many_keys_come) {
+  LockFreeCache<int, int> c(1000);
+  for (int k = 1; k <= 100000; ++k) {
+    c.insert(k, k);
+  }
+
+  EXPECT_GE(c.capacity(), c.size());
+  EXPECT_LT(c.capacity() * 9 / 10, c.size());
+
+  auto s = c.stats();
+  EXPECT_EQ(100000u, s.insertions);
+  EXPECT_EQ(s.insertions - static_cast<uint64_t>(c.size()), s.evictions);
+}
+
+TEST(CacheTests, Referenced_keys_get_a_second_chance) {
+  LockFreeCache<int, int> c(700);
+  for (int hot = 1; hot <= 100; ++hot) {
+    c.insert(hot, hot);
+  }
+
+  // hot keys are looked up between every batch of cold ones
+  for (int round = 0; round < 100; ++round) {
+    for (int hot = 1; hot <= 100; ++hot) {
+      c.get(hot) == 0 ? c.insert(hot, hot) : 0;
+    }
+    for (int cold = 0; cold < 50; ++cold) {
+      c.insert(1000 + round * 50 + cold, 1);
+    }
+  }
+
+  auto s = c.stats();
+  EXPECT_LT(s.misses * 20, s.hits);
+}
+
+TEST(CacheTests, Counts_hits_and_misses) {
+  LockFreeCache<int, int> c(64);
+  c.insert(1, 1);
+  c.get(1);
+  c.get(1);
+  c.get(2);
+
+  auto s = c.stats();
+  EXPECT_EQ(2u, s.hits);
+  EXPECT_EQ(1u, s.misses);
+  EXPECT_EQ(1u, s.insertions);
+  EXPECT_EQ(0u, s.evictions);
+}
+
+TEST(CacheTests, Racing_inserts_of_the_same_keys_leave_one_copy) {
+  LockFreeCache<int, int> c(7000);
+  const int keys = 4000;
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&c, t] {
+      for (int round = 0; round < 20; ++round) {
+        for (int k = 1; k <= keys; ++k) {
+          c.insert(k, k + t);
+        }
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  // a leftover copy would still show after its winner is removed
+  for (int k = 1; k <= keys; ++k) {
+    auto v = c.remove(k);
+    if (v != 0) {
+      EXPECT_LE(k, v);
+      EXPECT_GE(k + 3, v);
+    }
+    EXPECT_EQ(0, c.get(k)) << "key " << k;
+  }
+  EXPECT_EQ(0, c.size());
+}
+
+// A second copy of a key would survive the eviction of the first. Six more keys
+// fit the set next to one copy, next to two the last of them evicts the lower one.
+TEST(CacheTests, Evicting_the_winning_copy_leaves_no_stale_value) {
+  for (int trial = 0; trial < 2000; ++trial) {
+    LockFreeCache<int, int> c(7);
+    std::atomic<bool> go(false);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([&c, &go, t] {
+        while (!go.load()) {}
+        c.insert(1, 10 + t);
+      });
+    }
+    go = true;
+    for (auto& t : threads) t.join();
+    ASSERT_EQ(1, c.size()) << "trial " << trial;
+
+    c.insert(1, 100);
+    for (int k = 2; k <= 7; ++k) {
+      c.insert(k, k);
+    }
+    ASSERT_EQ(100, c.get(1)) << "trial " << trial;
+  }
+}
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+#include "lockfree/filter.h"
+#include "lockfree/lockfree.h"
+
+#include <thread>
+#include <vector>
+
+TEST(KeyFilterTests, Finds_every_added_hash) {
+  KeyFilter f(10000);
+  for (uint32_t h = 0; h < 10000; ++h) f.add(h * 2654435761u);
+  for (uint32_t h = 0; h < 10000; ++h) EXPECT_TRUE(f.mayContain(h * 2654435761u));
+}
+
+TEST(KeyFilterTests, Rules_out_most_other_hashes_when_full) {
+  KeyFilter f(100000);
+  for (uint32_t h = 1; h <= 100000; ++h) f.add(h);
+
+  auto falsePositives = 0;
+  for (uint32_t h = 200001; h <= 300000; ++h) {
+    if (f.mayContain(h)) ++falsePositives;
+  }
+  EXPECT_LT(falsePositives, 3000);
+}
+
+TEST(KeyFilterTests, Is_complete_once_published) {
+  KeyFilter f(1);
+  EXPECT_FALSE(f.isComplete());
+  f.complete();
+  EXPECT_TRUE(f.isComplete());
+}
+
+// keys stay visible and removable while their tables get filtered and migrated
+TEST(KeyFilterTests, Filtered_tables_keep_every_key) {
+  LockFreeMap<int, int> m(16);
+  const int keys = 200000;
+
+  for (int k = 1; k <= keys; ++k) {
+    m.insert(k, k);
+    if (k % 1000 == 0) {
+      for (int j = k - 999; j <= k; j += 97) ASSERT_EQ(j, m.get(j));
+      ASSERT_EQ(0, m.get(keys + k));
+    }
+  }
+  for (int k = 1; k <= keys; k += 2) ASSERT_EQ(k, m.remove(k));
+  for (int k = 1; k <= keys; ++k) ASSERT_EQ(k % 2 == 0 ? k : 0, m.get(k));
+}
+
+TEST(KeyFilterTests, Readers_find_keys_while_tables_are_filtered) {
+  LockFreeMap<int, int> m(16);
+  const int keys = 100000;
+  std::atomic<int> written(0);
+
+  std::thread writer([&]() {
+    for (int k = 1; k <= keys; ++k) {
+      m.insert(k, k);
+      written.store(k);
+    }
+  });
+
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 3; ++t) {
+    readers.emplace_back([&, t]() {
+      for (int k = 1 + t; k <= keys; k += 3) {
+        while (written.load() < k) std::this_thread::yield();
+        ASSERT_EQ(k, m.get(k));
+        ASSERT_EQ(0, m.get(keys + k));
+      }
+    });
+  }
+
+  writer.join();
+  for (auto& r : readers) r.join();
+}
@@ -20,3 +20,85 @@ TEST_F(IndexTests,Insert_and_get_indices_greater_than_size) {
 
   EXPECT_EQ(1,m -> get(9));
 }
+
+struct consecutive_keys {
+  template <typename K>
+  static K key(int i) { return i; }
+};
+
+// clustered under identity hashing
+struct strided_keys {
+  template <typename K>
+  static K key(int i) { return static_cast<K>(i) * 64; }
+};
+
+// a few keys far from the rest, which don't fit within a probe bound
+struct outlying_keys {
+  template <typename K>
+  static K key(int i) { return i % 7 == 0 ? static_cast<K>(i) * 1000 : i; }
+};
+
+// A map to grow through the policies of its table, with a load factor the table
+// can take and keys that give its probing something to do.
+template <typename Tmap, int LoadPercent = 50, typename Tkeys = consecutive_keys>
+struct GrowthCase {
+  using MapType = Tmap;
+  using KeyType = typename Tmap::KeyType;
+
+  static double loadFactor() { return LoadPercent / 100.0; }
+  static KeyType key(int i) { return Tkeys::template key<KeyType>(i); }
+};
+
+template <typename Table, typename Traits = key_traits<int>>
+using TableMap = LockFreeMap<int, int, Traits, value_traits<int>, epoch_reclamation, Table>;
+
+template <typename Case>
+void growAndCheck() {
+  typename Case::MapType m(16, Case::loadFactor());
+
+  for (int i = 1; i <= 2000; ++i) {
+    m.insert(Case::key(i), i + 1);
+    EXPECT_EQ(i + 1, m.fetchAdd(Case::key(i), 0));
+  }
+  EXPECT_EQ(7, m.remove(Case::key(6)));
+
+  for (int i = 1; i <= 2000; ++i) {
+    EXPECT_EQ(i == 6 ? 0 : i + 1, m.get(Case::key(i))) << "key " << Case::key(i);
+  }
+  EXPECT_EQ(0, m.get(Case::key(2001)));
+}
+
+template <typename Case>
+class IndexPolicyTests : public ::testing::Test {};
+
+typedef ::testing::Types<
+  GrowthCase<TableMap<Table<int, int, key_traits<int, multiply_shift_hash>, value_traits<int>, pow2_indexing>, key_traits<int, multiply_shift_hash>>>,
+  GrowthCase<TableMap<Table<int, int, key_traits<int>, value_traits<int>, pow2_indexing, split_layout>>>,
+  GrowthCase<LockFreeMap<long long, int, key_traits<long long>, value_traits<int>, epoch_reclamation,
+                         Table<long long, int, key_traits<long long>, value_traits<int>, pow2_indexing, packed_layout, mmap_allocation>>>
+> IndexedMaps;
+TYPED_TEST_CASE(IndexPolicyTests, IndexedMaps);
+
+TYPED_TEST(IndexPolicyTests, Growth_keeps_every_key) {
+  growAndCheck<TypeParam>();
+}
+
+template <typename Case>
+class ProbingPolicyTests : public ::testing::Test {};
+
+using IdentityTraits = key_traits<int, identity_hash>;
+
+// load factors linear probing would crawl at, triangular steps out of clusters,
+// keys that don't fit within a bound grow the table early
+typedef ::testing::Types<
+  GrowthCase<TableMap<Table<int, int, IdentityTraits, value_traits<int>, pow2_indexing, packed_layout, heap_allocation, triangular_probing>, IdentityTraits>,
+             90, strided_keys>,
+  GrowthCase<TableMap<Table<int, int, IdentityTraits, value_traits<int>, modulo_indexing, packed_layout, heap_allocation, bounded_probing<4>>, IdentityTraits>,
+             90, outlying_keys>,
+  GrowthCase<TableMap<Table<int, int, key_traits<int>, value_traits<int>, pow2_indexing, packed_layout, mmap_allocation, two_choice_probing<8>>>, 70>
+> ProbedMaps;
+TYPED_TEST_CASE(ProbingPolicyTests, ProbedMaps);
+
+TYPED_TEST(ProbingPolicyTests, Growth_keeps_every_key) {
+  growAndCheck<TypeParam>();
+}
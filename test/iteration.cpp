@@ -0,0 +1,128 @@
+#include "gtest/gtest.h"
+#include "lockfree/lockfree.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TEST(IterationTests, Empty_map_reports_nothing) {
+  LockFreeMap<int, int> m(16);
+  auto calls = 0;
+  m.forEach([&calls](int, int) { ++calls; });
+
+  EXPECT_EQ(0, calls);
+  auto iteration = m.iterate();
+  EXPECT_TRUE(iteration.begin() == iteration.end());
+}
+
+TEST(IterationTests, Every_key_is_reported_once_across_old_tables) {
+  LockFreeMap<int, int> m(4);
+  for (int k = 1; k <= 1000; ++k) {
+    m.insert(k, k * 10);
+  }
+  for (int k = 1; k <= 100; ++k) {
+    m.insert(k, k * 20);
+  }
+  for (int k = 901; k <= 1000; ++k) {
+    m.remove(k);
+  }
+
+  std::map<int, int> seen;
+  m.forEach([&seen](int k, int v) {
+    EXPECT_TRUE(seen.insert(std::make_pair(k, v)).second) << "key " << k << " twice";
+  });
+
+  ASSERT_EQ(900u, seen.size());
+  for (int k = 1; k <= 900; ++k) {
+    EXPECT_EQ(k <= 100 ? k * 20 : k * 10, seen[k]);
+  }
+}
+
+TEST(IterationTests, Range_for_over_an_iteration) {
+  LockFreeMap<int, int> m(64);
+  for (int k = 1; k <= 20; ++k) {
+    m.insert(k, k);
+  }
+
+  auto sum = 0;
+  for (auto& kv : m.iterate()) {
+    EXPECT_EQ(kv.first, kv.second);
+    sum += kv.second;
+  }
+  EXPECT_EQ(210, sum);
+}
+
+TEST(IterationTests, Parallel_for_each_covers_every_chunk) {
+  LockFreeMap<int, int> m(100000);
+  for (int k = 1; k <= 40000; ++k) {
+    m.insert(k, 1);
+  }
+
+  std::vector<std::atomic<int>> counts(40001);
+  for (auto& c : counts) c = 0;
+  m.parallelForEach([&counts](int k, int v) { counts[k] += v; }, 4);
+
+  for (int k = 1; k <= 40000; ++k) {
+    EXPECT_EQ(1, counts[k].load()) << "key " << k;
+  }
+}
+
+TEST(IterationTests, Untouched_keys_are_seen_while_writers_grow_the_map) {
+  LockFreeMap<int, int> m(8);
+  for (int k = 1; k <= 2000; ++k) {
+    m.insert(k, k);
+  }
+
+  std::atomic<bool> done(false);
+  std::thread writer([&m, &done] {
+    for (int k = 100000; !done; ++k) {
+      m.insert(k, k);
+      m.get(k - 50000);
+    }
+  });
+
+  for (int round = 0; round < 20; ++round) {
+    std::vector<int> counts(2001, 0);
+    std::mutex mutex;
+    m.parallelForEach([&counts, &mutex](int k, int) {
+      if (k <= 2000) {
+        std::lock_guard<std::mutex> lg(mutex);
+        ++counts[k];
+      }
+    }, 2);
+
+    for (int k = 1; k <= 2000; ++k) {
+      ASSERT_EQ(1, counts[k]) << "key " << k << " in round " << round;
+    }
+  }
+
+  done = true;
+  writer.join();
+}
+
+// nothing drains while the iteration lasts, so retired tables pile up far past a
+// hundred and every one of them has to stay reachable
+TEST(IterationTests, Old_tables_pile_up_while_an_iteration_lasts) {
+  LockFreeMap<int, int> m(16);
+  {
+    auto iteration = m.iterate();
+    for (int k = 1; k <= 2000; ++k) {
+      m.insert(k, k);
+      if (k % 10 != 0) m.remove(k);
+    }
+    for (int k = 1; k <= 2000; ++k) {
+      ASSERT_EQ(k % 10 == 0 ? k : 0, m.get(k)) << "key " << k;
+    }
+  }
+
+  for (int k = 2001; k <= 4000; ++k) {
+    m.insert(k, k);
+  }
+  std::map<int, int> seen;
+  m.forEach([&seen](int k, int v) { seen[k] = v; });
+  EXPECT_EQ(200u + 2000u, seen.size());
+  for (int k = 1; k <= 4000; ++k) {
+    EXPECT_EQ(k % 10 == 0 || k > 2000 ? k : 0, m.get(k)) << "key " << k;
+  }
+}
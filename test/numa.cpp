@@ -0,0 +1,96 @@
+#include "gtest/gtest.h"
+#include "lockfree/numa.h"
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+TEST(NumaTests, There_is_a_node_at_least) {
+  EXPECT_GE(numa_topology::nodes(), 1);
+  EXPECT_GE(numa_topology::currentNode(), 0);
+  EXPECT_LT(numa_topology::currentNode(), numa_topology::nodes());
+}
+
+TEST(NumaTests, Placements_nest) {
+  EXPECT_EQ(-1, NumaPlacement::node());
+  {
+    NumaPlacement outer(0);
+    {
+      NumaPlacement inner(1);
+      EXPECT_EQ(1, NumaPlacement::node());
+    }
+    EXPECT_EQ(0, NumaPlacement::node());
+  }
+  EXPECT_EQ(-1, NumaPlacement::node());
+}
+
+// pages are checked once touched, with the node the kernel reports for each
+TEST(NumaTests, Interleaved_pages_spread_over_the_nodes) {
+  const size_t pages = 64, pageSize = 4096;
+  auto p = static_cast<char*>(numa_allocation::allocate(pages * pageSize));
+  std::memset(p, 1, pages * pageSize);
+
+  std::vector<int> perNode(numa_topology::nodes());
+  for (size_t i = 0; i < pages; ++i) {
+    auto node = numa_topology::nodeOf(p + i * pageSize);
+    ASSERT_GE(node, 0);
+    ASSERT_LT(node, numa_topology::nodes());
+    ++perNode[node];
+  }
+  for (auto count : perNode) {
+    EXPECT_GT(count, 0);
+  }
+  numa_allocation::release(p, pages * pageSize);
+}
+
+TEST(NumaTests, Placed_pages_sit_on_their_node) {
+  auto node = numa_topology::nodes() - 1;
+  NumaPlacement placement(node);
+
+  const size_t bytes = 1 << 20;
+  auto p = static_cast<char*>(numa_allocation::allocate(bytes));
+  std::memset(p, 1, bytes);
+  for (size_t offset = 0; offset < bytes; offset += 64 * 1024) {
+    EXPECT_EQ(node, numa_topology::nodeOf(p + offset));
+  }
+  numa_allocation::release(p, bytes);
+}
+
+TEST(ReplicatedMapTests, Writes_reach_every_replica) {
+  ReplicatedLockFreeMap<int, int> m(16, 0.5, 4.0, 3);
+  ASSERT_EQ(3, m.replicaCount());
+
+  for (int k = 1; k <= 1000; ++k) {
+    m.insert(k, k + 1);
+  }
+  EXPECT_EQ(8, m.remove(7));
+
+  for (int r = 0; r < m.replicaCount(); ++r) {
+    for (int k = 1; k <= 1000; ++k) {
+      ASSERT_EQ(k == 7 ? 0 : k + 1, m.replica(r).get(k)) << "replica " << r;
+    }
+  }
+  EXPECT_EQ(2, m.get(1));
+}
+
+TEST(ReplicatedMapTests, Replicas_agree_after_racing_writers) {
+  ReplicatedLockFreeMap<int, int> m(16, 0.5, 4.0, 2);
+  const int keys = 500, threads = 4;
+
+  std::vector<std::thread> writers;
+  for (int t = 0; t < threads; ++t) {
+    writers.emplace_back([&m, t] {
+      for (int round = 0; round < 20; ++round) {
+        for (int k = 1; k <= keys; ++k) {
+          if ((k + round + t) % 5 == 0) m.remove(k);
+          else m.insert(k, t * 1000 + round + 1);
+        }
+      }
+    });
+  }
+  for (auto& w : writers) w.join();
+
+  for (int k = 1; k <= keys; ++k) {
+    EXPECT_EQ(m.replica(0).get(k), m.replica(1).get(k)) << "key " << k;
+  }
+}
@@ -0,0 +1,116 @@
+#include "gtest/gtest.h"
+#include "lockfree/persistence.h"
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+
+using PlainMap = LockFreeMap<int, int>;
+using IdentityMap = LockFreeMap<int, int, key_traits<int, identity_hash>, value_traits<int>, epoch_reclamation,
+                                Table<int, int, key_traits<int, identity_hash>, value_traits<int>>>;
+using SplitMap = LockFreeMap<int, long long, key_traits<int>, value_traits<long long>, epoch_reclamation,
+                             Table<int, long long, key_traits<int>, value_traits<long long>, pow2_indexing, split_layout>>;
+
+class PersistenceTests : public ::testing::Test {
+protected:
+  PersistenceTests(): path(::testing::TempDir() + "lockfree_table_" + ::testing::UnitTest::GetInstance()->current_test_info()->name()) {}
+  ~PersistenceTests() { std::remove(path.c_str()); }
+
+  std::string path;
+};
+
+TEST_F(PersistenceTests, Saved_tables_load_with_their_keys) {
+  PlainMap m(4);
+  for (int k = 1; k <= 5000; ++k) {
+    m.insert(k, k * 3);
+  }
+  for (int k = 1; k <= 100; ++k) {
+    m.remove(k);
+  }
+  saveSnapshot(m, path);
+
+  PlainMap loaded(loadTable<PlainMap>(path));
+  for (int k = 1; k <= 5000; ++k) {
+    EXPECT_EQ(k <= 100 ? 0 : k * 3, loaded.get(k));
+  }
+}
+
+TEST_F(PersistenceTests, Loaded_maps_keep_growing) {
+  SplitMap m(64);
+  for (int k = 1; k <= 20; ++k) {
+    m.insert(k, k);
+  }
+  saveSnapshot(m, path);
+
+  SplitMap loaded(loadTable<SplitMap>(path));
+  for (int k = 21; k <= 20000; ++k) {
+    loaded.insert(k, k);
+  }
+  for (int k = 1; k <= 20000; ++k) {
+    EXPECT_EQ(k, loaded.get(k));
+  }
+}
+
+TEST_F(PersistenceTests, Writes_to_a_loaded_map_stay_out_of_the_file) {
+  PlainMap m(64);
+  m.insert(1, 1);
+  saveSnapshot(m, path);
+
+  {
+    PlainMap loaded(loadTable<PlainMap>(path));
+    loaded.insert(1, 2);
+    loaded.insert(2, 2);
+  }
+
+  PlainMap again(loadTable<PlainMap>(path));
+  EXPECT_EQ(1, again.get(1));
+  EXPECT_EQ(0, again.get(2));
+}
+
+TEST_F(PersistenceTests, Corrupted_cells_fail_the_checksum) {
+  PlainMap m(64);
+  m.insert(1, 1);
+  saveSnapshot(m, path);
+
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(TableFileHeader::Bytes + 8);
+    file.put('x');
+  }
+
+  EXPECT_THROW(loadTable<PlainMap>(path, true), std::runtime_error);
+  delete loadTable<PlainMap>(path);
+}
+
+TEST_F(PersistenceTests, Tables_of_another_type_are_refused) {
+  PlainMap m(64);
+  m.insert(1, 1);
+  saveSnapshot(m, path);
+
+  EXPECT_THROW(loadTable<IdentityMap>(path), std::runtime_error);
+  EXPECT_THROW(loadTable<SplitMap>(path), std::runtime_error);
+  EXPECT_THROW(loadTable<PlainMap>(path + ".missing"), std::runtime_error);
+}
+
+TEST_F(PersistenceTests, Snapshots_are_taken_while_writers_run) {
+  PlainMap m(16);
+  for (int k = 1; k <= 1000; ++k) {
+    m.insert(k, k);
+  }
+
+  std::thread writer([&m] {
+    for (int k = 1001; k <= 200000; ++k) {
+      m.insert(k, k);
+    }
+  });
+  for (int round = 0; round < 5; ++round) {
+    saveSnapshot(m, path);
+  }
+  writer.join();
+
+  PlainMap loaded(loadTable<PlainMap>(path));
+  for (int k = 1; k <= 1000; ++k) {
+    EXPECT_EQ(k, loaded.get(k));
+  }
+}
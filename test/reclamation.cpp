@@ -0,0 +1,101 @@
+#include "gtest/gtest.h"
+#include "lockfree/lockfree.h"
+#include "lockfree/reclamation.h"
+#include <atomic>
+#include <thread>
+
+struct Tracked {
+  Tracked(std::atomic<int>* deletions): m_deletions(deletions) {}
+  ~Tracked() { ++*m_deletions; }
+
+  std::atomic<int>* m_deletions;
+};
+
+TEST(EpochReclamationTests, Retired_object_is_freed_when_nobody_is_pinned) {
+  std::atomic<int> deletions(0);
+  epoch_reclamation::retire(new Tracked(&deletions));
+
+  for (int i = 0; i < 3 && deletions == 0; ++i) {
+    epoch_reclamation::collect();
+  }
+
+  EXPECT_EQ(1, deletions);
+}
+
+TEST(EpochReclamationTests, Retired_object_survives_a_pinned_reader) {
+  std::atomic<int> deletions(0);
+  std::atomic<bool> pinned(false), release(false);
+
+  std::thread reader([&]() {
+    epoch_reclamation::guard g;
+    pinned = true;
+    while (!release) std::this_thread::yield();
+  });
+  while (!pinned) std::this_thread::yield();
+
+  epoch_reclamation::retire(new Tracked(&deletions));
+  for (int i = 0; i < 10; ++i) {
+    epoch_reclamation::collect();
+  }
+  EXPECT_EQ(0, deletions);
+
+  release = true;
+  reader.join();
+
+  for (int i = 0; i < 3 && deletions == 0; ++i) {
+    epoch_reclamation::collect();
+  }
+  EXPECT_EQ(1, deletions);
+}
+
+TEST(EpochReclamationTests, Guards_nest) {
+  std::atomic<int> deletions(0);
+  {
+    epoch_reclamation::guard outer;
+    {
+      epoch_reclamation::guard inner;
+    }
+
+    epoch_reclamation::retire(new Tracked(&deletions));
+    epoch_reclamation::collect();
+    epoch_reclamation::collect();
+    EXPECT_EQ(0, deletions);
+  }
+
+  for (int i = 0; i < 3 && deletions == 0; ++i) {
+    epoch_reclamation::collect();
+  }
+  EXPECT_EQ(1, deletions);
+}
+
+struct counting_reclamation {
+  struct guard {
+    guard() {}
+  };
+
+  template <typename T>
+  static void retire(T* p) {
+    ++retired;
+    delete p;
+  }
+
+  static void collect() {}
+
+  static int retired;
+};
+int counting_reclamation::retired = 0;
+
+TEST(MapReclamationTests, Drained_tables_are_retired) {
+  counting_reclamation::retired = 0;
+  LockFreeMap<int, int, key_traits<int>, value_traits<int>, counting_reclamation> m(4);
+
+  for (int i = 1; i <= 1000; ++i) {
+    m.insert(i, i);
+  }
+  for (int i = 1; i <= 1000; ++i) {
+    EXPECT_EQ(i, m.get(i));
+  }
+
+  // 4 cells growing by 4 up to 4096 leaves 5 old tables
+  EXPECT_EQ(5, counting_reclamation::retired);
+}
@@ -0,0 +1,73 @@
+#include "gtest/gtest.h"
+#include "lockfree/sharded.h"
+#include <set>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+TEST(ShardedTests, Insert_get_and_remove) {
+  ShardedLockFreeMap<int, int> m(64);
+
+  EXPECT_EQ(0, m.get(1));
+  EXPECT_EQ(11, m.insert(1, 11));
+  EXPECT_EQ(11, m.get(1));
+  EXPECT_EQ(11, m.remove(1));
+  EXPECT_EQ(0, m.get(1));
+}
+
+TEST(ShardedTests, Keys_spread_over_the_shards) {
+  std::vector<int> perShard(ShardedLockFreeMap<int, int>::ShardCount, 0);
+  for (int k = 1; k <= 16000; ++k) {
+    ++perShard[ShardedLockFreeMap<int, int>::shardIndexFor(k)];
+  }
+
+  for (auto count : perShard) {
+    EXPECT_LT(800, count);
+    EXPECT_GT(1200, count);
+  }
+}
+
+// the top 7 bits of the hash are TaggedTable's tags
+TEST(ShardedTests, Keys_of_a_shard_keep_every_tag) {
+  using Map = ShardedLockFreeMap<int, int>;
+  std::set<uint32_t> tags;
+  for (int k = 1; k <= 16000; ++k) {
+    if (Map::shardIndexFor(k) == 0) tags.insert(key_traits<int>::hash(k) >> 25);
+  }
+  EXPECT_EQ(128u, tags.size());
+}
+
+static_assert(!std::is_copy_constructible<ShardedLockFreeMap<int, int>>::value, "shards are owned by one map");
+static_assert(!std::is_copy_assignable<ShardedLockFreeMap<int, int>>::value, "shards are owned by one map");
+
+TEST(ShardedTests, Shard_count_needs_not_be_a_power_of_two) {
+  ShardedLockFreeMap<int, int, 3> m(30);
+  for (int k = 1; k <= 3000; ++k) {
+    m.insert(k, k + 5);
+  }
+  for (int k = 1; k <= 3000; ++k) {
+    EXPECT_EQ(k + 5, m.get(k));
+  }
+  EXPECT_LT(0, m.shard(0).get(1) + m.shard(1).get(1) + m.shard(2).get(1));
+}
+
+TEST(ShardedTests, Concurrent_inserts_grow_every_shard) {
+  ShardedLockFreeMap<int, int, 8> m(8);
+  std::vector<std::thread> threads;
+
+  for (int id = 0; id < 4; ++id) {
+    threads.emplace_back([&m, id]() {
+      for (int i = 1; i <= 20000; ++i) {
+        auto k = id * 100000 + i;
+        while (m.insert(k, i) == 0) {}
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  for (int id = 0; id < 4; ++id) {
+    for (int i = 1; i <= 20000; ++i) {
+      ASSERT_EQ(i, m.get(id * 100000 + i));
+    }
+  }
+}
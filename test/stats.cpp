@@ -0,0 +1,143 @@
+#include "gtest/gtest.h"
+#include "lockfree/lockfree.h"
+#include "lockfree/sharded.h"
+#include <vector>
+
+using IdentityMap = LockFreeMap<int, int, key_traits<int, identity_hash>, value_traits<int>, epoch_reclamation,
+                                Table<int, int, key_traits<int, identity_hash>, value_traits<int>>>;
+
+static uint64_t probes(const MapStatsSnapshot& s) {
+  uint64_t total = 0;
+  for (auto count : s.probeLengths) total += count;
+  return total;
+}
+
+TEST(StatsTests, Are_enabled) {
+  EXPECT_TRUE(bool(map_stats::Enabled));
+}
+
+TEST(StatsTests, Operations_are_counted) {
+  LockFreeMap<int, int> m(64);
+  m.insert(1, 10);
+  m.insert(2, 20);
+  m.insert(2, 21);
+  m.get(1);
+  m.get(3);
+  m.remove(2);
+
+  auto s = m.stats();
+  EXPECT_EQ(3u, s.inserts);
+  EXPECT_EQ(2u, s.gets);
+  EXPECT_EQ(1u, s.removes);
+  EXPECT_EQ(0u, s.resizes);
+  EXPECT_EQ(0u, s.failedInsertions);
+  EXPECT_EQ(6u, probes(s));
+}
+
+TEST(StatsTests, Probe_lengths_land_in_power_of_2_buckets) {
+  IdentityMap m(16);
+  m.insert(1, 1);
+  m.insert(17, 17);
+  m.insert(33, 33);
+  m.insert(49, 49);
+
+  auto s = m.stats();
+  EXPECT_EQ(1u, s.probeLengths[0]);
+  EXPECT_EQ(2u, s.probeLengths[1]);
+  EXPECT_EQ(1u, s.probeLengths[2]);
+
+  EXPECT_EQ(0, MapStatsSnapshot::bucketOf(1));
+  EXPECT_EQ(1, MapStatsSnapshot::bucketOf(3));
+  EXPECT_EQ(MapStatsSnapshot::ProbeBuckets - 1, MapStatsSnapshot::bucketOf(1 << 30));
+}
+
+TEST(StatsTests, Resizes_and_old_table_lookups_are_counted) {
+  LockFreeMap<int, int> m(1000);
+  for (int k = 1; k <= 500; ++k) {
+    m.insert(k, k);
+  }
+  for (int k = 1; k <= 500; ++k) {
+    EXPECT_EQ(k, m.get(k));
+  }
+
+  auto s = m.stats();
+  EXPECT_EQ(1u, s.resizes);
+  EXPECT_LT(0u, s.oldTableLookups);
+  EXPECT_GT(500u, s.oldTableLookups);
+}
+
+TEST(StatsTests, Sharded_map_sums_its_shards) {
+  ShardedLockFreeMap<int, int, 4> m(64);
+  for (int k = 1; k <= 100; ++k) {
+    m.insert(k, k);
+    m.get(k);
+  }
+
+  auto s = m.stats();
+  EXPECT_EQ(100u, s.inserts);
+  EXPECT_EQ(100u, s.gets);
+  EXPECT_EQ(m.shard(0).stats().inserts + m.shard(1).stats().inserts + m.shard(2).stats().inserts + m.shard(3).stats().inserts, s.inserts);
+}
+
+TEST(StatsTests, Churn_compacts_instead_of_growing) {
+  LockFreeMap<int, int> m(64);
+  for (int k = 1; k <= 100000; ++k) {
+    m.insert(k, k);
+    if (k > 10) m.remove(k - 10);
+  }
+
+  auto s = m.stats();
+  EXPECT_LT(0u, s.compactions);
+  EXPECT_EQ(s.resizes, s.compactions);
+}
+
+TEST(StatsTests, Reinserted_keys_reuse_their_cells) {
+  LockFreeMap<int, int> m(64);
+  for (int round = 0; round < 1000; ++round) {
+    for (int k = 1; k <= 20; ++k) {
+      m.insert(k, round + 1);
+    }
+    for (int k = 1; k <= 20; ++k) {
+      m.remove(k);
+    }
+  }
+
+  EXPECT_EQ(0u, m.stats().resizes);
+}
+
+TEST(StatsTests, Bulk_loads_size_the_table_once) {
+  std::vector<std::pair<int, int>> pairs;
+  for (int k = 1; k <= 100000; ++k) {
+    pairs.push_back(std::make_pair(k, k));
+  }
+
+  LockFreeMap<int, int> built(pairs.begin(), pairs.end());
+  EXPECT_EQ(0u, built.stats().resizes);
+
+  LockFreeMap<int, int> loaded(64);
+  for (int k = -10; k < 0; ++k) {
+    loaded.insert(k, k);
+  }
+  loaded.bulkLoad(pairs.begin(), pairs.end());
+  EXPECT_EQ(1u, loaded.stats().resizes);
+}
+
+// the keys of the table that was just retired still have to move in as well
+TEST(StatsTests, Bulk_loads_right_after_a_growth_size_the_table_once) {
+  LockFreeMap<int, int> m(64);
+  for (int k = -32; k < 0; ++k) {
+    m.insert(k, k);
+  }
+  ASSERT_EQ(1u, m.stats().resizes);
+
+  std::vector<std::pair<int, int>> pairs;
+  for (int k = 1; k <= 100; ++k) {
+    pairs.push_back(std::make_pair(k, k));
+  }
+  m.bulkLoad(pairs.begin(), pairs.end(), 1);
+  EXPECT_EQ(2u, m.stats().resizes);
+
+  for (int k = -32; k <= 100; ++k) {
+    EXPECT_EQ(k, m.get(k));
+  }
+}
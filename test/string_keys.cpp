@@ -0,0 +1,98 @@
+#include "gtest/gtest.h"
+#include "lockfree/string_keys.h"
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST(StringKeysTests, Insert_get_and_remove) {
+  StringLockFreeMap<int> m(16);
+
+  EXPECT_EQ(0, m.get("session"));
+  EXPECT_EQ(7, m.insert("session", 7));
+  EXPECT_EQ(7, m.get("session"));
+  EXPECT_EQ(0, m.get("sessions"));
+  EXPECT_EQ(7, m.remove("session"));
+  EXPECT_EQ(0, m.get("session"));
+}
+
+TEST(StringKeysTests, Lookups_dont_need_the_inserted_object) {
+  StringLockFreeMap<int> m(16);
+  m.insert(std::string("symbol"), 3);
+
+  const char buffer[] = "a symbol table";
+  EXPECT_EQ(3, m.get(buffer + 2, 6));
+  EXPECT_EQ(0, m.get(buffer + 2, 5));
+#if __cplusplus >= 201703L
+  EXPECT_EQ(3, m.get(std::string_view(buffer).substr(2, 6)));
+#endif
+}
+
+TEST(StringKeysTests, Updates_and_reinserts_keep_one_key) {
+  StringLockFreeMap<int> m(16);
+  m.insert("k", 1);
+  m.insert("k", 2);
+  m.remove("k");
+  m.insert("k", 3);
+
+  EXPECT_EQ(3, m.get("k"));
+  EXPECT_EQ(3, m.remove("k"));
+  EXPECT_EQ(0, m.get("k"));
+}
+
+TEST(StringKeysTests, Keys_may_hold_any_byte) {
+  StringLockFreeMap<int> m(16);
+  m.insert(std::string("a\0b", 3), 1);
+  m.insert(std::string("a\0c", 3), 2);
+  m.insert("", 3);
+
+  EXPECT_EQ(1, m.get(std::string("a\0b", 3)));
+  EXPECT_EQ(2, m.get(std::string("a\0c", 3)));
+  EXPECT_EQ(0, m.get("a"));
+  EXPECT_EQ(3, m.get(""));
+}
+
+TEST(StringKeysTests, Equal_contents_are_equal_keys) {
+  StringArena arena;
+  auto hash = ArenaString::hashOf("abc", 3);
+  auto a = string_key_traits::wordFor(arena.add("abc", 3, hash));
+  auto b = string_key_traits::wordFor(arena.add("abc", 3, hash));
+  auto c = string_key_traits::wordFor(arena.add("abd", 3, ArenaString::hashOf("abd", 3)));
+
+  EXPECT_NE(a, b);
+  EXPECT_TRUE(string_key_traits::equal(a, b));
+  EXPECT_FALSE(string_key_traits::equal(a, c));
+  EXPECT_EQ(hash, string_key_traits::hash(b));
+}
+
+TEST(StringKeysTests, Values_survive_growth_and_long_keys) {
+  StringLockFreeMap<int> m(4);
+  std::string longKey(100000, 'x');
+  m.insert(longKey, -1);
+
+  for (int i = 1; i <= 5000; ++i) {
+    m.insert("key" + std::to_string(i), i);
+  }
+
+  EXPECT_EQ(-1, m.get(longKey));
+  for (int i = 1; i <= 5000; ++i) {
+    EXPECT_EQ(i, m.get("key" + std::to_string(i)));
+  }
+}
+
+TEST(StringKeysTests, Concurrent_inserts_of_the_same_keys) {
+  StringLockFreeMap<int> m(8);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&m]() {
+      for (int i = 1; i <= 2000; ++i) {
+        m.insert("key" + std::to_string(i), i);
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+
+  for (int i = 1; i <= 2000; ++i) {
+    EXPECT_EQ(i, m.get("key" + std::to_string(i)));
+  }
+}
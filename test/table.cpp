@@ -1,26 +1,39 @@
 #include "gtest/gtest.h"
 #include "lockfree/table.h"
+#include <type_traits>
 
-TEST(TableTests, Error_when_there_are_more_free_cells_than_cells) {
-  EXPECT_ANY_THROW( (Table<int, int>(1,2)) );
+template <typename Layout, typename K, typename V, typename KT = key_traits<K>>
+using LayoutTable = Table<K, V, KT, value_traits<V>, modulo_indexing, Layout>;
+
+template <typename Layout>
+using Pow2Table = Table<int, int, key_traits<int, identity_hash>, value_traits<int>, pow2_indexing, Layout>;
+
+template <typename Layout>
+class TableTests : public ::testing::Test {};
+
+typedef ::testing::Types<interleaved_layout, split_layout, packed_layout> Layouts;
+TYPED_TEST_CASE(TableTests, Layouts);
+
+TYPED_TEST(TableTests, Error_when_there_are_more_free_cells_than_cells) {
+  EXPECT_ANY_THROW( (LayoutTable<TypeParam, int, int>(1,2)) );
 }
 
-TEST(TableTests, Error_when_the_number_of_cells_is_zero) {
-  EXPECT_ANY_THROW((Table<int, int>(0,2)));
+TYPED_TEST(TableTests, Error_when_the_number_of_cells_is_zero) {
+  EXPECT_ANY_THROW((LayoutTable<TypeParam, int, int>(0,2)));
 }
 
-TEST(TableTests, Error_when_the_number_of_cells_is_negative) {
-  EXPECT_ANY_THROW((Table<int, int>(-1,2)));
+TYPED_TEST(TableTests, Error_when_the_number_of_cells_is_negative) {
+  EXPECT_ANY_THROW((LayoutTable<TypeParam, int, int>(-1,2)));
 }
 
-TEST(TableTests, Finding_on_an_empty_table) {
-  Table<int, int> t(10, 10);
+TYPED_TEST(TableTests, Finding_on_an_empty_table) {
+  LayoutTable<TypeParam, int, int> t(10, 10);
 
   EXPECT_EQ(nullptr, t.findFirstCellFor(9));
 }
 
-TEST(TableTests, Ask_for_a_cell_and_receive) {
-  Table<int, int> t(10, 10);
+TYPED_TEST(TableTests, Ask_for_a_cell_and_receive) {
+  LayoutTable<TypeParam, int, int> t(10, 10);
   auto cell = t.fillFirstCellFor(9);
 
   auto foundCell = t.findFirstCellFor(9);
@@ -29,16 +42,16 @@ TEST(TableTests, Ask_for_a_cell_and_receive) {
   EXPECT_EQ(0, foundCell->value.load());
 }
 
-TEST(TableTests, Ask_for_a_cell_twice) {
-  Table<int, int> t(10, 10);
+TYPED_TEST(TableTests, Ask_for_a_cell_twice) {
+  LayoutTable<TypeParam, int, int> t(10, 10);
   auto cell1 = t.fillFirstCellFor(9);
   auto cell2 = t.fillFirstCellFor(9);
 
   EXPECT_EQ(cell1, cell2);
 }
 
-TEST(TableTests, Ask_for_a_cell_twice_second_time_no_space_left) {
-  Table<int, int> t(10, 3);
+TYPED_TEST(TableTests, Ask_for_a_cell_twice_second_time_no_space_left) {
+  LayoutTable<TypeParam, int, int> t(10, 3);
   auto cell1 = t.fillFirstCellFor(1);
   auto cell2 = t.fillFirstCellFor(2);
   auto cell3 = t.fillFirstCellFor(3);
@@ -46,8 +59,8 @@ TEST(TableTests, Ask_for_a_cell_twice_second_time_no_space_left) {
   EXPECT_EQ(cell1, t.findFirstCellFor(1));
 }
 
-TEST(TableTests, Find_a_cell_when_map_contains_more_elements) {
-  Table<int, int> t(10, 3);
+TYPED_TEST(TableTests, Find_a_cell_when_map_contains_more_elements) {
+  LayoutTable<TypeParam, int, int> t(10, 3);
   auto cell1 = t.fillFirstCellFor(1);
   auto cell2 = t.fillFirstCellFor(2);
   auto cell3 = t.fillFirstCellFor(3);
@@ -58,8 +71,8 @@ TEST(TableTests, Find_a_cell_when_map_contains_more_elements) {
   EXPECT_EQ(cell2, t.findFirstCellFor(2));
 }
 
-TEST(TableTests, When_full_cant_fill_anymore) {
-  Table<int, int> t(3, 3);
+TYPED_TEST(TableTests, When_full_cant_fill_anymore) {
+  LayoutTable<TypeParam, int, int> t(3, 3);
   auto cell1 = t.fillFirstCellFor(1);
   auto cell2 = t.fillFirstCellFor(2);
   auto cell3 = t.fillFirstCellFor(3);
@@ -71,8 +84,8 @@ TEST(TableTests, When_full_cant_fill_anymore) {
   EXPECT_EQ(nullptr, t.fillFirstCellFor(4));
 }
 
-TEST(TableTests, When_full_CAN_fill_even_if_there_are_still_empty_cells) {
-  Table<int, int> t(4, 3);
+TYPED_TEST(TableTests, When_full_CAN_fill_even_if_there_are_still_empty_cells) {
+  LayoutTable<TypeParam, int, int> t(4, 3);
   auto cell1 = t.fillFirstCellFor(1);
   auto cell2 = t.fillFirstCellFor(2);
   auto cell3 = t.fillFirstCellFor(3);
@@ -90,16 +103,36 @@ struct custom_key_traits {
     return n % 10;
   }
 };
-TEST(TableTests, When_two_keys_have_the_same_hash) {
-  Table<int, int, custom_key_traits> t(10, 10);
+TYPED_TEST(TableTests, When_two_keys_have_the_same_hash) {
+  LayoutTable<TypeParam, int, int, custom_key_traits> t(10, 10);
   auto cell1 = t.fillFirstCellFor(9);
   auto cell2 = t.fillFirstCellFor(19);
 
   EXPECT_NE(cell1, cell2);
 }
 
-TEST(TableTests, Sanity_for_when_types_are_char) {
-  Table<char, char> t(10, 10);
+TYPED_TEST(TableTests, Finding_a_key_that_wrapped_around) {
+  LayoutTable<TypeParam, int, int, custom_key_traits> t(10, 10);
+  t.fillFirstCellFor(9);
+  auto cell = t.fillFirstCellFor(19);
+
+  EXPECT_EQ(cell, t.findFirstCellFor(19));
+  EXPECT_EQ(nullptr, t.findFirstCellFor(29));
+}
+
+TYPED_TEST(TableTests, Removing_a_key_doesnt_break_the_chain_behind_it) {
+  LayoutTable<TypeParam, int, int, custom_key_traits> t(10, 10);
+  t.fillFirstCellFor(5)->value.store(15);
+  t.fillFirstCellFor(15)->value.store(25);
+
+  t.findFirstCellFor(5)->value.store(0);
+
+  ASSERT_NE(nullptr, t.findFirstCellFor(15));
+  EXPECT_EQ(25, t.findFirstCellFor(15)->value.load());
+}
+
+TYPED_TEST(TableTests, Sanity_for_when_types_are_char) {
+  LayoutTable<TypeParam, char, char> t(10, 10);
 
   auto emptyCell = t.findFirstCellFor('a');
   ASSERT_EQ(nullptr, emptyCell);
@@ -114,8 +147,8 @@ TEST(TableTests, Sanity_for_when_types_are_char) {
   ASSERT_EQ(0, foundCell->value.load());
 }
 
-TEST(TableTests, Sanity_for_when_types_are_longlongs) {
-  Table<long long, long long> t(10, 10);
+TYPED_TEST(TableTests, Sanity_for_when_types_are_longlongs) {
+  LayoutTable<TypeParam, long long, long long> t(10, 10);
 
   long long k = 2405237205;
 
@@ -138,8 +171,8 @@ struct custom_key_traits_pointer {
     return *n % 10;
   }
 };
-TEST(TableTests, Sanity_for_when_types_are_pointers_hashing_on_address) {
-  Table<int*, int*, custom_key_traits_pointer> t(10, 10);
+TYPED_TEST(TableTests, Sanity_for_when_types_are_pointers_hashing_on_address) {
+  LayoutTable<TypeParam, int*, int*, custom_key_traits_pointer> t(10, 10);
 
   int keyVal = 25;
 
@@ -158,6 +191,161 @@ TEST(TableTests, Sanity_for_when_types_are_pointers_hashing_on_address) {
   ASSERT_EQ(nullptr, foundCell->value.load());
 }
 
+TYPED_TEST(TableTests, Insert_or_assign_reports_the_previous_value) {
+  LayoutTable<TypeParam, int, int> t(10, 10);
+  auto previous = -1;
+
+  auto cell = t.insertOrAssign(9, key_traits<int>::hash(9), 19, previous);
+  ASSERT_NE(nullptr, cell);
+  EXPECT_EQ(0, previous);
+  EXPECT_EQ(19, cell->value.load());
+
+  EXPECT_EQ(cell, t.insertOrAssign(9, key_traits<int>::hash(9), 29, previous));
+  EXPECT_EQ(19, previous);
+  EXPECT_EQ(29, t.findFirstCellFor(9)->value.load());
+}
+
+TYPED_TEST(TableTests, Insert_or_assign_on_a_full_table) {
+  LayoutTable<TypeParam, int, int> t(2, 2);
+  auto previous = 0;
+  t.insertOrAssign(1, key_traits<int>::hash(1), 11, previous);
+  t.insertOrAssign(2, key_traits<int>::hash(2), 12, previous);
+
+  EXPECT_EQ(nullptr, t.insertOrAssign(3, key_traits<int>::hash(3), 13, previous));
+  EXPECT_EQ(11, t.findFirstCellFor(1)->value.load());
+}
+
+TYPED_TEST(TableTests, Power_of_two_capacity_is_rounded_up) {
+  Pow2Table<TypeParam> t(10, 10);
+
+  EXPECT_EQ(16, t.m_size);
+  EXPECT_EQ(16, Pow2Table<TypeParam>(16, 10).m_size);
+  EXPECT_EQ(1, Pow2Table<TypeParam>(1, 1).m_size);
+}
+
+TYPED_TEST(TableTests, Power_of_two_errors_are_kept) {
+  EXPECT_ANY_THROW((Pow2Table<TypeParam>(0, 2)));
+  EXPECT_ANY_THROW((Pow2Table<TypeParam>(-1, 2)));
+  EXPECT_ANY_THROW((Pow2Table<TypeParam>(3, 5)));
+}
+
+TYPED_TEST(TableTests, Power_of_two_probe_wraps_around) {
+  Pow2Table<TypeParam> t(4, 4);
+  auto cell1 = t.fillFirstCellFor(3);
+  auto cell2 = t.fillFirstCellFor(7);
+
+  EXPECT_EQ(t.cellAt(3), cell1);
+  EXPECT_EQ(t.cellAt(0), cell2);
+  EXPECT_EQ(cell2, t.findFirstCellFor(7));
+  EXPECT_EQ(nullptr, t.findFirstCellFor(11));
+}
+
+template <typename Layout>
+using MappedTable = Table<int, int, key_traits<int>, value_traits<int>, pow2_indexing, Layout, mmap_allocation>;
+
+TYPED_TEST(TableTests, Mapped_tables_start_out_empty) {
+  // big enough for a huge page
+  MappedTable<TypeParam> t(1 << 20, 1 << 20);
+
+  EXPECT_EQ(nullptr, t.findFirstCellFor(5));
+  t.fillFirstCellFor(5)->value.store(15);
+  EXPECT_EQ(15, t.findFirstCellFor(5)->value.load());
+  EXPECT_EQ(0, t.cellAt((1 << 20) - 1)->value.load());
+}
+
+struct minus_one_value_traits {
+  static int defaultValue() { return -1; }
+};
+
+TYPED_TEST(TableTests, Mapped_tables_clear_cells_that_arent_zero) {
+  Table<int, int, key_traits<int>, minus_one_value_traits, pow2_indexing, TypeParam, mmap_allocation> t(100, 100);
+
+  EXPECT_EQ(-1, t.cellAt(0)->value.load());
+  EXPECT_EQ(-1, t.cellAt(127)->value.load());
+}
+
+TEST(PackedLayoutTests, Pairs_that_fit_a_word_are_packed) {
+  EXPECT_TRUE((std::is_same<PackedCell<int, int>, Table<int, int>::CellType>::value));
+  EXPECT_TRUE((std::is_same<PackedCell<char, short>, Table<char, short>::CellType>::value));
+  EXPECT_TRUE((std::is_same<Element<long long, int>*, Table<long long, int>::CellType>::value));
+}
+
+TEST(PackedLayoutTests, Value_writes_keep_the_key) {
+  Table<char, short> t(10, 10);
+  auto cell = t.fillFirstCellFor('a');
+
+  cell->value.store(7);
+  EXPECT_EQ(7, cell->value.exchange(-8));
+
+  short expected = 5;
+  EXPECT_FALSE(cell->value.compare_exchange_strong(expected, 9));
+  EXPECT_EQ(-8, expected);
+  EXPECT_TRUE(cell->value.compare_exchange_strong(expected, 9));
+
+  EXPECT_EQ('a', cell->key.load());
+  EXPECT_EQ(9, cell->value.load());
+  EXPECT_EQ(cell, t.findFirstCellFor('a'));
+}
+
+TEST(ProbingPolicyTests, Triangular_probing_visits_every_cell) {
+  Table<int, int, key_traits<int, identity_hash>, value_traits<int>, pow2_indexing, packed_layout, heap_allocation, triangular_probing> t(16, 16);
+
+  // every key has cell 0 as its home
+  for (int i = 1; i <= 16; ++i) {
+    ASSERT_NE(nullptr, t.fillFirstCellFor(i * 16));
+  }
+  EXPECT_EQ(nullptr, t.fillFirstCellFor(17 * 16));
+  for (int i = 1; i <= 16; ++i) {
+    EXPECT_EQ(i * 16, t.findFirstCellFor(i * 16)->key.load());
+  }
+}
+
+TEST(ProbingPolicyTests, Bounded_probing_stops_at_its_limit) {
+  Table<int, int, key_traits<int, identity_hash>, value_traits<int>, modulo_indexing, packed_layout, heap_allocation, bounded_probing<4>> t(64, 64);
+
+  for (int i = 1; i <= 4; ++i) {
+    ASSERT_NE(nullptr, t.fillFirstCellFor(i * 64));
+  }
+  bool claimed = true;
+  EXPECT_EQ(nullptr, t.fillFirstCellFor(5 * 64, 0, claimed));
+  EXPECT_FALSE(claimed);
+  EXPECT_EQ(nullptr, t.findFirstCellFor(5 * 64));
+
+  // past the run, cells are still free for keys at home there
+  EXPECT_NE(nullptr, t.fillFirstCellFor(5));
+  EXPECT_EQ(4 * 64, t.findFirstCellFor(4 * 64)->key.load());
+}
+
+TEST(ProbingPolicyTests, Two_choice_probing_stays_in_two_buckets) {
+  Table<int, int, key_traits<int, identity_hash>, value_traits<int>, modulo_indexing, packed_layout, heap_allocation, two_choice_probing<4>> t(30, 30);
+  ASSERT_EQ(32, t.m_size);
+
+  // every key has bucket 0 as its first one, a key whose second one is full as well
+  // doesn't fit, whatever else is free
+  auto placed = 0, inFirstBucket = 0;
+  for (int i = 1; i <= 32; ++i) {
+    auto cell = t.fillFirstCellFor(i * 32);
+    if (cell == nullptr) break;
+
+    ++placed;
+    for (int idx = 0; idx < 4; ++idx) {
+      if (t.cellAt(idx) == cell) ++inFirstBucket;
+    }
+    EXPECT_EQ(cell, t.findFirstCellFor(i * 32));
+  }
+
+  EXPECT_EQ(4, inFirstBucket);
+  EXPECT_LT(placed, 32);
+  EXPECT_EQ(nullptr, t.findFirstCellFor(33 * 32));
+}
+
+TEST(HashPolicyTests, Hash_policies) {
+  EXPECT_EQ(42u, identity_hash::hash(42));
+  EXPECT_EQ(murmur_hash::hash(42), key_traits<int>::hash(42));
+  EXPECT_EQ(multiply_shift_hash::hash(42), (key_traits<int, multiply_shift_hash>::hash(42)));
+  EXPECT_NE(multiply_shift_hash::hash(1) >> 28, multiply_shift_hash::hash(2) >> 28);
+}
+
 TEST(DecayingTableTests, Construct_a_null_table) {
   EXPECT_ANY_THROW((DecayingTable<int, int>(nullptr)));
 }
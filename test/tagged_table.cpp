@@ -0,0 +1,115 @@
+#include "gtest/gtest.h"
+#include "lockfree/lockfree.h"
+#include "lockfree/tagged_table.h"
+#include <thread>
+#include <vector>
+
+TEST(TaggedTableTests, Errors_like_table) {
+  EXPECT_ANY_THROW((TaggedTable<int, int>(0, 2)));
+  EXPECT_ANY_THROW((TaggedTable<int, int>(-1, 2)));
+  EXPECT_ANY_THROW((TaggedTable<int, int>(100, 200)));
+}
+
+TEST(TaggedTableTests, Capacity_is_at_least_a_group) {
+  TaggedTable<int, int> t(1, 1);
+  EXPECT_LE(TagGroup::Width, t.m_size);
+}
+
+TEST(TaggedTableTests, Finding_on_an_empty_table) {
+  TaggedTable<int, int> t(100, 100);
+
+  EXPECT_EQ(nullptr, t.findFirstCellFor(9));
+}
+
+TEST(TaggedTableTests, Ask_for_a_cell_and_receive) {
+  TaggedTable<int, int> t(100, 100);
+  auto cell = t.fillFirstCellFor(9);
+  cell->value.store(90);
+
+  auto foundCell = t.findFirstCellFor(9);
+  EXPECT_EQ(cell, foundCell);
+  EXPECT_EQ(9, foundCell->key.load());
+  EXPECT_EQ(90, foundCell->value.load());
+  EXPECT_EQ(cell, t.fillFirstCellFor(9));
+}
+
+struct same_hash_key_traits {
+  static int defaultValue() { return 0; }
+  static uint32_t hash (int) {
+    return 0xfe000005;
+  }
+};
+TEST(TaggedTableTests, Keys_with_the_same_hash_and_tag) {
+  TaggedTable<int, int, same_hash_key_traits> t(64, 64);
+  for (int k = 1; k <= 40; ++k) {
+    t.fillFirstCellFor(k)->value.store(k * 10);
+  }
+
+  for (int k = 1; k <= 40; ++k) {
+    ASSERT_NE(nullptr, t.findFirstCellFor(k));
+    EXPECT_EQ(k * 10, t.findFirstCellFor(k)->value.load());
+  }
+  EXPECT_EQ(nullptr, t.findFirstCellFor(41));
+}
+
+struct last_cell_key_traits {
+  static int defaultValue() { return 0; }
+  static uint32_t hash (int n) {
+    return 63 + (static_cast<uint32_t>(n) << 25);
+  }
+};
+TEST(TaggedTableTests, Probe_wraps_around_the_end) {
+  TaggedTable<int, int, last_cell_key_traits> t(64, 64);
+  auto cell1 = t.fillFirstCellFor(1);
+  auto cell2 = t.fillFirstCellFor(2);
+  auto cell3 = t.fillFirstCellFor(3);
+
+  EXPECT_EQ(t.cellAt(63), cell1);
+  EXPECT_EQ(t.cellAt(0), cell2);
+  EXPECT_EQ(t.cellAt(1), cell3);
+  EXPECT_EQ(cell3, t.findFirstCellFor(3));
+  EXPECT_EQ(nullptr, t.findFirstCellFor(4));
+}
+
+TEST(TaggedTableTests, When_full_cant_fill_anymore) {
+  TaggedTable<int, int> t(64, 64);
+  for (int k = 1; k <= t.m_size; ++k) {
+    ASSERT_NE(nullptr, t.fillFirstCellFor(k));
+  }
+
+  EXPECT_EQ(nullptr, t.fillFirstCellFor(t.m_size + 1));
+  EXPECT_EQ(nullptr, t.findFirstCellFor(t.m_size + 1));
+  EXPECT_NE(nullptr, t.findFirstCellFor(t.m_size));
+}
+
+TEST(TaggedTableTests, Concurrent_fills_of_overlapping_keys) {
+  TaggedTable<int, int> t(4096, 4096);
+  std::vector<std::thread> threads;
+
+  for (int id = 0; id < 4; ++id) {
+    threads.emplace_back([&t, id]() {
+      for (int k = 1 + id * 500; k <= 1000 + id * 500; ++k) {
+        t.fillFirstCellFor(k)->value.store(k);
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+
+  for (int k = 1; k <= 2500; ++k) {
+    auto cell = t.fillFirstCellFor(k);
+    ASSERT_EQ(cell, t.findFirstCellFor(k));
+    EXPECT_EQ(k, cell->value.load());
+  }
+}
+
+TEST(TaggedTableTests, As_the_table_of_a_map) {
+  LockFreeMap<int, int, key_traits<int>, value_traits<int>, epoch_reclamation, TaggedTable<int, int, key_traits<int>, value_traits<int>, pow2_indexing>> m(16);
+
+  for (int i = 1; i <= 5000; ++i) {
+    m.insert(i, -i);
+  }
+  for (int i = 1; i <= 5000; ++i) {
+    EXPECT_EQ(-i, m.get(i));
+  }
+  EXPECT_EQ(0, m.get(5001));
+}
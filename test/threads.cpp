@@ -185,3 +185,92 @@ TEST_F(ThreadSafetyTests, DISABLED_random_actions_when_map_doesnt_grow) {
   EXPECT_GE(size, elementsInMap);
   EXPECT_LE(size*0.9, elementsInMap);
 }
+
+// threads count every key up, each starting at a key of its own
+template <typename Map>
+void countConcurrently(Map& counters) {
+  const int keys = 2000, rounds = 20, threads = 4;
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&counters, t] {
+      for (int round = 0; round < rounds; ++round) {
+        for (int k = 1; k <= keys; ++k) {
+          counters.fetchAdd((k + t * 7) % keys + 1, 1);
+        }
+      }
+    });
+  }
+  for (auto& w : workers) w.join();
+
+  for (int k = 1; k <= keys; ++k) {
+    EXPECT_EQ(rounds * threads, counters.get(k)) << "key " << k;
+  }
+}
+
+TEST(ThreadSafetyRmwTests, Counters_stay_exact_while_the_map_grows) {
+  LockFreeMap<int, int> counters(8);
+  countConcurrently(counters);
+}
+
+// two choice tables overflow before they run out of free cells, concurrently
+TEST(ThreadSafetyRmwTests, Counters_stay_exact_in_overflowing_two_choice_tables) {
+  using TwoChoiceTable = Table<int, int, key_traits<int>, value_traits<int>, modulo_indexing, packed_layout, heap_allocation, two_choice_probing<4>>;
+  LockFreeMap<int, int, key_traits<int>, value_traits<int>, epoch_reclamation, TwoChoiceTable> counters(8, 0.9);
+  countConcurrently(counters);
+}
+
+// every thread creates each key, most of them while an old table is in its grace period
+TEST(ThreadSafetyRmwTests, Counters_stay_exact_on_new_keys_while_the_map_grows) {
+  const int keys = 50000, trials = 5, threads = 8;
+
+  for (int trial = 0; trial < trials; ++trial) {
+    LockFreeMap<int, int> counters(8);
+
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+      workers.emplace_back([&counters] {
+        for (int k = 1; k <= keys; ++k) {
+          counters.fetchAdd(k, 1);
+        }
+      });
+    }
+    for (auto& w : workers) w.join();
+
+    for (int k = 1; k <= keys; ++k) {
+      ASSERT_EQ(threads, counters.get(k)) << "key " << k << ", trial " << trial;
+    }
+  }
+}
+
+// keys that never leave the map are found while a writer grows it under the readers
+TEST(ThreadSafetyGrowthTests, Stable_keys_are_found_while_the_map_grows) {
+  const int stable = 2000, trials = 10, readers = 4;
+
+  for (int trial = 0; trial < trials; ++trial) {
+    LockFreeMap<int, int> m(8);
+    for (int k = 1; k <= stable; ++k) {
+      m.insert(k, k);
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<int> misses(0);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+      threads.emplace_back([&m, &done, &misses] {
+        while (!done.load()) {
+          for (int k = 1; k <= stable; ++k) {
+            if (m.get(k) != k) ++misses;
+          }
+        }
+      });
+    }
+    for (int k = 1; k <= 200000; ++k) {
+      m.insert(stable + k, 1);
+    }
+    done = true;
+    for (auto& t : threads) t.join();
+
+    ASSERT_EQ(0, misses.load()) << "trial " << trial;
+  }
+}